@@ -2,22 +2,44 @@
 #include <stdlib.h>
 #include <time.h>
 #include <string.h>
+#include <stdint.h>
 
 #define GRID_SIZE 10
 #define NUM_SHIPS 5
 
 typedef enum { EMPTY, SHIP, HIT, MISS, DESTROYED } CellStatus;
 
+// Bitboard: one bit per cell, bit number is row * GRID_SIZE + col
+typedef struct {
+    uint64_t lo; // cells 0..63
+    uint64_t hi; // cells 64..127
+} Bitboard;
+
+// A board: ship cells, hit cells and missed cells.
+// A board with ships on it also keeps which ship owns each cell and how many
+// cells of each ship are left, so a shot knows HIT / SUNK / WIN right away.
+typedef struct {
+    Bitboard ships;
+    Bitboard hits;
+    Bitboard misses;
+    unsigned char shipAt[GRID_SIZE * GRID_SIZE]; // ship index + 1, 0 = water
+    unsigned char hitsLeft[NUM_SHIPS];           // cells of each ship not hit yet
+    int shipsLeft;                               // ships still afloat
+} Board;
+
+// What a shot did
+typedef enum { SHOT_MISS, SHOT_HIT, SHOT_SUNK, SHOT_WIN } ShotResult;
+
 typedef struct {
     int size;
     char name[20];
 } Ship;
 
 typedef struct {
-    CellStatus **playerShips;
-    CellStatus **playerShots;
-    CellStatus **computerShips;
-    CellStatus **computerShots;
+    Board *playerShips;
+    Board *playerShots;
+    Board *computerShips;
+    Board *computerShots;
 } GameState;
 
 // Ship list: size and name
@@ -29,36 +51,71 @@ Ship ships[NUM_SHIPS] = {
     {2, "Destroyer"}
 };
 
+// Bit number of a cell
+static inline int CellIndex(int row, int col) {
+    return row * GRID_SIZE + col;
+}
+
+// Is bit idx set?
+static inline int BitboardTest(Bitboard b, int idx) {
+    return idx < 64 ? (int)((b.lo >> idx) & 1u) : (int)((b.hi >> (idx - 64)) & 1u);
+}
+
+// Set bit idx
+static inline void BitboardSet(Bitboard *b, int idx) {
+    if (idx < 64) b->lo |= 1ULL << idx;
+    else b->hi |= 1ULL << (idx - 64);
+}
+
+// Any bit set?
+static inline int BitboardAny(Bitboard b) {
+    return (b.lo | b.hi) != 0;
+}
+
+// Remove the lowest set bit and return its number (b must not be empty)
+static inline int BitboardPopLowest(Bitboard *b) {
+    if (b->lo) {
+        int idx = __builtin_ctzll(b->lo);
+        b->lo &= b->lo - 1;
+        return idx;
+    }
+    int idx = 64 + __builtin_ctzll(b->hi);
+    b->hi &= b->hi - 1;
+    return idx;
+}
+
 // Allocate a new grid
-CellStatus **AllocateGrid() {
-    CellStatus **grid = malloc(GRID_SIZE * sizeof(CellStatus *));
+Board *AllocateGrid() {
+    Board *grid = calloc(1, sizeof(Board));
     if (!grid) {
         printf("Memory allocation failed!\n");
         exit(1);
     }
-    for (int i = 0; i < GRID_SIZE; i++) {
-        grid[i] = malloc(GRID_SIZE * sizeof(CellStatus));
-        if (!grid[i]) {
-            printf("Memory allocation failed!\n");
-            exit(1);
-        }
-        for (int j = 0; j < GRID_SIZE; j++) {
-            grid[i][j] = EMPTY;
-        }
-    }
     return grid;
 }
 
 // Free a grid
-void FreeGrid(CellStatus **grid) {
-    for (int i = 0; i < GRID_SIZE; i++) {
-        free(grid[i]);
-    }
+void FreeGrid(Board *grid) {
     free(grid);
 }
 
+// Read one cell back as a CellStatus
+CellStatus GridCell(Board *grid, int row, int col) {
+    int idx = CellIndex(row, col);
+    if (BitboardTest(grid->hits, idx)) return HIT;
+    if (BitboardTest(grid->misses, idx)) return MISS;
+    if (BitboardTest(grid->ships, idx)) return SHIP;
+    return EMPTY;
+}
+
+// Has this cell been shot at already?
+int GridAlreadyShot(Board *grid, int row, int col) {
+    int idx = CellIndex(row, col);
+    return BitboardTest(grid->hits, idx) || BitboardTest(grid->misses, idx);
+}
+
 // Print a grid
-void PrintGrid(CellStatus **grid, int hideShips) {
+void PrintGrid(Board *grid, int hideShips) {
     printf("    ");
     for (int j = 0; j < GRID_SIZE; j++) printf("%2d ", j);
     printf("\n");
@@ -66,7 +123,7 @@ void PrintGrid(CellStatus **grid, int hideShips) {
         printf("%c ", 'A' + i);
         for (int j = 0; j < GRID_SIZE; j++) {
             char symbol = ' ';
-            switch (grid[i][j]) {
+            switch (GridCell(grid, i, j)) {
                 case EMPTY: symbol = '.'; break;
                 case SHIP: symbol = hideShips ? '.' : 'S'; break;
                 case HIT: symbol = 'X'; break;
@@ -80,7 +137,7 @@ void PrintGrid(CellStatus **grid, int hideShips) {
 }
 
 // Randomly place ships on a grid
-void RandomlyPlaceShips(CellStatus **grid) {
+void RandomlyPlaceShips(Board *grid) {
     for (int s = 0; s < NUM_SHIPS; s++) {
         int placed = 0;
         while (!placed) {
@@ -88,27 +145,23 @@ void RandomlyPlaceShips(CellStatus **grid) {
             int col = rand() % GRID_SIZE;
             int vertical = rand() % 2;
             int size = ships[s].size;
-            int fits = 1;
 
-            if (vertical) {
-                if (row + size > GRID_SIZE) continue;
-                for (int i = 0; i < size; i++)
-                    if (grid[row + i][col] != EMPTY) fits = 0;
-                if (fits) {
-                    for (int i = 0; i < size; i++)
-                        grid[row + i][col] = SHIP;
-                    placed = 1;
-                }
-            } else {
-                if (col + size > GRID_SIZE) continue;
-                for (int i = 0; i < size; i++)
-                    if (grid[row][col + i] != EMPTY) fits = 0;
-                if (fits) {
-                    for (int i = 0; i < size; i++)
-                        grid[row][col + i] = SHIP;
-                    placed = 1;
-                }
-            }
+            if (vertical && row + size > GRID_SIZE) continue;
+            if (!vertical && col + size > GRID_SIZE) continue;
+
+            // Build the ship's cells as a mask, then one AND checks overlap
+            Bitboard mask = {0, 0};
+            for (int i = 0; i < size; i++)
+                BitboardSet(&mask, vertical ? CellIndex(row + i, col) : CellIndex(row, col + i));
+            if ((mask.lo & grid->ships.lo) || (mask.hi & grid->ships.hi)) continue;
+
+            grid->ships.lo |= mask.lo;
+            grid->ships.hi |= mask.hi;
+            for (int i = 0; i < size; i++)
+                grid->shipAt[vertical ? CellIndex(row + i, col) : CellIndex(row, col + i)] = s + 1;
+            grid->hitsLeft[s] = size;
+            grid->shipsLeft++;
+            placed = 1;
         }
     }
 }
@@ -142,43 +195,138 @@ void TeardownSinglePlayer(GameState *game) {
 }
 
 // Check if all ships are destroyed
-int SinglePlayerDidWin(CellStatus **grid) {
-    for (int i = 0; i < GRID_SIZE; i++) {
-        for (int j = 0; j < GRID_SIZE; j++) {
-            if (grid[i][j] == SHIP) return 0;
-        }
+int SinglePlayerDidWin(Board *grid) {
+    return grid->shipsLeft == 0;
+}
+
+// Name of the ship on this cell (only call it for ship cells)
+const char *ShipNameAt(Board *grid, int row, int col) {
+    return ships[grid->shipAt[CellIndex(row, col)] - 1].name;
+}
+
+// Apply a shot to a ship board and the matching shot board
+ShotResult ApplyShot(Board *ships, Board *shots, int row, int col) {
+    int idx = CellIndex(row, col);
+    if (BitboardTest(ships->hits, idx)) return SHOT_MISS; // already sunk this part
+    int owner = ships->shipAt[idx];
+    if (!owner) {
+        BitboardSet(&ships->misses, idx);
+        BitboardSet(&shots->misses, idx);
+        return SHOT_MISS;
     }
-    return 1;
+    BitboardSet(&ships->hits, idx);
+    BitboardSet(&shots->hits, idx);
+    if (--ships->hitsLeft[owner - 1] > 0) return SHOT_HIT;
+    return --ships->shipsLeft == 0 ? SHOT_WIN : SHOT_SUNK;
 }
 
 // Player takes a shot
-int MakeSinglePlayerShot(GameState *game, int row, int col) {
-    if (game->computerShips[row][col] == SHIP) {
-        game->computerShips[row][col] = HIT;
-        game->playerShots[row][col] = HIT;
-        return 1;
-    } else {
-        game->computerShips[row][col] = MISS;
-        game->playerShots[row][col] = MISS;
-        return 0;
+ShotResult MakeSinglePlayerShot(GameState *game, int row, int col) {
+    return ApplyShot(game->computerShips, game->playerShots, row, col);
+}
+
+// Every way each ship size can lie on the board, built on first use
+#define MAX_PLACEMENTS (2 * GRID_SIZE * GRID_SIZE)
+#define TARGET_WEIGHT 40
+Bitboard placements[GRID_SIZE + 1][MAX_PLACEMENTS];
+int placementCount[GRID_SIZE + 1];
+
+void BuildPlacements() {
+    if (placementCount[1]) return;
+    for (int size = 1; size <= GRID_SIZE; size++) {
+        int n = 0;
+        for (int vertical = 0; vertical < 2; vertical++) {
+            if (size == 1 && vertical) break; // one cell is the same both ways
+            for (int row = 0; row < GRID_SIZE; row++) {
+                for (int col = 0; col < GRID_SIZE; col++) {
+                    if (vertical ? row + size > GRID_SIZE : col + size > GRID_SIZE) continue;
+                    Bitboard mask = {0, 0};
+                    for (int i = 0; i < size; i++)
+                        BitboardSet(&mask, vertical ? CellIndex(row + i, col) : CellIndex(row, col + i));
+                    placements[size][n++] = mask;
+                }
+            }
+        }
+        placementCount[size] = n;
+    }
+}
+
+// Count, for every cell, how many placements of the ships still afloat
+// could cover it. Placements through a miss or a sunk ship are impossible;
+// placements through open hits are much more likely, so the computer
+// chases a ship once it finds one and leaves it alone once it sinks.
+// sunk holds the cells of the sunk ships, afloat has bit s set for each
+// ship not sunk yet.
+void ComputeHeatMap(Board *known, Bitboard sunk, unsigned afloat, int heat[GRID_SIZE * GRID_SIZE]) {
+    BuildPlacements();
+    memset(heat, 0, GRID_SIZE * GRID_SIZE * sizeof(int));
+    Bitboard blocked = {known->misses.lo | sunk.lo, known->misses.hi | sunk.hi};
+    Bitboard open = {known->hits.lo & ~sunk.lo, known->hits.hi & ~sunk.hi};
+    for (int s = 0; s < NUM_SHIPS; s++) {
+        if (!(afloat & (1u << s))) continue;
+        int size = ships[s].size;
+        for (int p = 0; p < placementCount[size]; p++) {
+            Bitboard mask = placements[size][p];
+            if ((mask.lo & blocked.lo) || (mask.hi & blocked.hi)) continue;
+            int covers = __builtin_popcountll(mask.lo & open.lo) +
+                         __builtin_popcountll(mask.hi & open.hi);
+            int weight = 1 + covers * TARGET_WEIGHT;
+            Bitboard cells = {mask.lo & ~known->hits.lo, mask.hi & ~known->hits.hi};
+            while (BitboardAny(cells)) heat[BitboardPopLowest(&cells)] += weight;
+        }
     }
 }
 
-// Computer takes a random shot
+// Ships of a ship board that were sunk (and announced): their cells go in
+// *cells, and the result has bit s set for each ship still afloat
+unsigned ShipsAfloat(Board *grid, Bitboard *cells) {
+    unsigned afloat = 0;
+    cells->lo = cells->hi = 0;
+    for (int s = 0; s < NUM_SHIPS; s++)
+        if (grid->hitsLeft[s]) afloat |= 1u << s;
+    Bitboard hits = grid->hits;
+    while (BitboardAny(hits)) {
+        int idx = BitboardPopLowest(&hits);
+        if (!(afloat & (1u << (grid->shipAt[idx] - 1)))) BitboardSet(cells, idx);
+    }
+    return afloat;
+}
+
+// Computer shoots at the cell most likely to hold a ship
 void GetSinglePlayerShot(GameState *game) {
+    int heat[GRID_SIZE * GRID_SIZE];
+    Bitboard sunk;
+    unsigned afloat = ShipsAfloat(game->playerShips, &sunk);
+    ComputeHeatMap(game->computerShots, sunk, afloat, heat);
+
+    int best = -1, ties = 0;
+    for (int idx = 0; idx < GRID_SIZE * GRID_SIZE; idx++) {
+        if (heat[idx] == 0) continue;
+        if (best < 0 || heat[idx] > heat[best]) {
+            best = idx;
+            ties = 1;
+        } else if (heat[idx] == heat[best] && rand() % ++ties == 0) {
+            best = idx;
+        }
+    }
     int row, col;
-    do {
-        row = rand() % GRID_SIZE;
-        col = rand() % GRID_SIZE;
-    } while (game->computerShots[row][col] != EMPTY);
-
-    if (game->playerShips[row][col] == SHIP) {
-        game->playerShips[row][col] = HIT;
-        game->computerShots[row][col] = HIT;
+    if (best >= 0) {
+        row = best / GRID_SIZE;
+        col = best % GRID_SIZE;
+    } else {
+        // nothing fits what we know: fall back to a random new cell
+        do {
+            row = rand() % GRID_SIZE;
+            col = rand() % GRID_SIZE;
+        } while (GridAlreadyShot(game->computerShots, row, col));
+    }
+
+    ShotResult result = ApplyShot(game->playerShips, game->computerShots, row, col);
+    if (result >= SHOT_SUNK) {
+        printf("Computer sank your %s at %c%d!\n", ShipNameAt(game->playerShips, row, col), 'A' + row, col);
+    } else if (result == SHOT_HIT) {
         printf("Computer hit your ship at %c%d!\n", 'A' + row, col);
     } else {
-        game->playerShips[row][col] = MISS;
-        game->computerShots[row][col] = MISS;
         printf("Computer missed at %c%d.\n", 'A' + row, col);
     }
 }
@@ -221,8 +369,10 @@ int main() {
             continue;
         }
 
-        int hit = MakeSinglePlayerShot(game, row, col);
-        if (hit)
+        ShotResult result = MakeSinglePlayerShot(game, row, col);
+        if (result >= SHOT_SUNK)
+            printf("You sank the %s!\n", ShipNameAt(game->computerShips, row, col));
+        else if (result == SHOT_HIT)
             printf("You hit a ship!\n");
         else
             printf("You missed.\n");
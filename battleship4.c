@@ -11,11 +11,26 @@
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/ioctl.h>    /* terminal size for --ansi */
+#include <sys/mman.h>     /* mapping replay files */
+#include <sys/stat.h>
+#include <sys/syscall.h>  /* io_uring has no libc wrappers */
+#include <linux/io_uring.h>
 
 #include <stdarg.h>   /* needed for SendLine formatting */
 #include <strings.h>  /* for strcasecmp() */
+#include <stdint.h>   /* fixed-width words for bitboards */
+#include <pthread.h>  /* parallel simulation workers */
+#include <stdatomic.h>
 
 #define GRID_SIZE 10
+#define GRID_CELLS (GRID_SIZE * GRID_SIZE)
 #define NUM_SHIPS 5
 #define LINE_BUF 128
 
@@ -27,10 +42,42 @@ typedef struct {
     char name[20];
 } Ship;
 
-/* Game state: your ship grid and your shots */
+/* Bitboard: one bit per cell, bit number is row * GRID_SIZE + col.
+   Two 64-bit words are enough for all 100 cells. */
 typedef struct {
-    CellStatus **playerShips;
-    CellStatus **playerShots;
+    uint64_t lo; /* cells 0..63 */
+    uint64_t hi; /* cells 64..127 */
+} Bitboard;
+
+/* What a shot did. ApplyShotToGrid returns these bits and RESULT
+   messages carry them back to the shooter as they are. */
+#define RESULT_HIT  0x01
+#define RESULT_SUNK 0x02
+#define RESULT_WIN  0x04
+#define RESULT_SHIP_SHIFT 4 /* with RESULT_SUNK: index of the ship in ships[] */
+
+/* A board is three bitboards: ship cells, cells that were hit, and misses.
+   CellStatus is only used when we need to show or compare single cells.
+   A board with a fleet on it also knows which ship owns each cell and how
+   many cells of each ship are left, so a shot can tell HIT, SUNK and WIN
+   without looking at the rest of the board. */
+typedef struct {
+    Bitboard ships;
+    Bitboard hits;
+    Bitboard misses;
+    Bitboard sunk;                /* cells of ships that went down */
+    uint64_t key;                 /* Zobrist key of hits, misses and sunk ships */
+    Bitboard fleet[NUM_SHIPS];    /* cells of each ship */
+    uint8_t shipAt[GRID_CELLS];   /* ship index + 1 for each cell, 0 = water */
+    uint8_t hitsLeft[NUM_SHIPS];  /* cells of each ship not hit yet */
+    uint8_t afloat;               /* bit s set while ships[s] is afloat */
+    uint8_t shipsLeft;            /* ships not sunk yet */
+} Board;
+
+/* Game state: your ship grid and your shots, in one flat block */
+typedef struct {
+    Board playerShips;
+    Board playerShots;
 } GameState;
 
 /* List of ships used in the game */
@@ -42,401 +89,4118 @@ Ship ships[NUM_SHIPS] = {
     {2, "Destroyer"}
 };
 
-/* Memory helpers */
-
-/* Make a GRID_SIZE x GRID_SIZE grid filled with EMPTY */
-CellStatus **AllocateGrid(void) {
-    CellStatus **grid = malloc(GRID_SIZE * sizeof(CellStatus *));
-    if (!grid) { perror("malloc"); exit(EXIT_FAILURE); }
-    for (int r = 0; r < GRID_SIZE; ++r) {
-        grid[r] = malloc(GRID_SIZE * sizeof(CellStatus));
-        if (!grid[r]) { perror("malloc"); exit(EXIT_FAILURE); }
-        for (int c = 0; c < GRID_SIZE; ++c) grid[r][c] = EMPTY;
-    }
-    return grid;
+/* Ship index carried by a RESULT_SUNK result */
+static inline int ResultShip(int flags) {
+    return flags >> RESULT_SHIP_SHIFT;
 }
 
-/* Free a grid made by AllocateGrid */
-void FreeGrid(CellStatus **grid) {
-    if (!grid) return;
-    for (int r = 0; r < GRID_SIZE; ++r) free(grid[r]);
-    free(grid);
+/* Board size and fleet */
+
+/*
+ * The standard game is a 10x10 board with the five ships above, and all of
+ * the code built on Board is written for exactly that. --board RxC and
+ * --fleet pick another size and fleet; those games are played by the
+ * "Boards of any size" code further down, so the 10x10 path stays as it is.
+ * Rows are letters, so there are at most 26; columns go up to 99.
+ * Anything bigger, up to SPARSE_MAX_SIDE a side, is a sparse board (see
+ * "Sparse boards"), where --fleets N puts N copies of the fleet on it.
+ */
+
+#define WIDE_MAX_ROWS 26
+#define WIDE_MAX_COLS 99
+#define WIDE_MAX_SIDE WIDE_MAX_COLS
+#define WIDE_MAX_CELLS (WIDE_MAX_ROWS * WIDE_MAX_COLS)
+#define MAX_FLEET 32
+#define SPARSE_MAX_SIDE 1000000
+#define SPARSE_MAX_SHIPS (1 << 24)  /* ship index must fit a RESULT_SUNK result */
+
+typedef struct {
+    int rows;
+    int cols;
+    int shipCount;
+    Ship fleet[MAX_FLEET];
+    int fleets;  /* copies of the fleet on a sparse board */
+    int custom;  /* 1 unless this is the standard board and fleet */
+    int sparse;  /* 1 if the board is too big for a WideBoard */
+} BoardConfig;
+
+static BoardConfig boardConfig = { GRID_SIZE, GRID_SIZE, 0, {{0, ""}}, 1, 0, 0 };
+
+/* Name for a ship given only by its size */
+static const char *DefaultShipName(int size) {
+    static const char *names[] = { "Ship", "Patrol Boat", "Destroyer", "Cruiser", "Battleship", "Carrier" };
+    return size < (int)(sizeof(names) / sizeof(names[0])) ? names[size] : names[0];
 }
 
-/* Drawing the boards */
+/* Set up boardConfig from --board RxC, --fleet LIST and --fleets N (NULL
+   when not given). LIST is ship sizes separated by commas, each optionally
+   named: "5,4,3,3,2" or "Carrier:5,Tug:1". Returns -1 after printing why
+   the board or fleet cannot be used. */
+int ConfigureBoard(const char *board, const char *fleet, const char *fleets) {
+    BoardConfig *cfg = &boardConfig;
+    if (board) {
+        char x;
+        if (sscanf(board, "%d%c%d", &cfg->rows, &x, &cfg->cols) != 3 || (x != 'x' && x != 'X')) {
+            fprintf(stderr, "Invalid board size: %s (use RxC, e.g. 26x99)\n", board);
+            return -1;
+        }
+        if (cfg->rows < 1 || cfg->rows > SPARSE_MAX_SIDE || cfg->cols < 1 || cfg->cols > SPARSE_MAX_SIDE) {
+            fprintf(stderr, "Board sides must be 1..%d\n", SPARSE_MAX_SIDE);
+            return -1;
+        }
+        cfg->sparse = cfg->rows > WIDE_MAX_ROWS || cfg->cols > WIDE_MAX_COLS;
+    }
+    if (fleets) {
+        cfg->fleets = atoi(fleets);
+        if (cfg->fleets < 1 || cfg->fleets > SPARSE_MAX_SHIPS || (cfg->fleets > 1 && !cfg->sparse)) {
+            fprintf(stderr, "--fleets needs a count of 1 or more and a board bigger than %dx%d\n",
+                    WIDE_MAX_ROWS, WIDE_MAX_COLS);
+            return -1;
+        }
+    }
 
-/* Print one grid; if hideShips is 1 we do not show S for ships */
-void PrintGrid(CellStatus **grid, int hideShips) {
-    printf("    ");
-    for (int c = 0; c < GRID_SIZE; ++c) printf("%2d ", c);
-    printf("\n");
-    for (int r = 0; r < GRID_SIZE; ++r) {
-        printf("%c  ", 'A' + r);
-        for (int c = 0; c < GRID_SIZE; ++c) {
-            char ch;
-            switch (grid[r][c]) {
-                case EMPTY: ch = '.'; break;
-                case SHIP:  ch = hideShips ? '.' : 'S'; break;
-                case HIT:   ch = 'X'; break;
-                case MISS:  ch = 'o'; break;
-                default:    ch = '?'; break;
+    cfg->shipCount = 0;
+    if (!fleet) {
+        for (int s = 0; s < NUM_SHIPS; ++s) cfg->fleet[cfg->shipCount++] = ships[s];
+    } else {
+        const char *p = fleet;
+        while (*p) {
+            if (cfg->shipCount == MAX_FLEET) {
+                fprintf(stderr, "At most %d ships in a fleet\n", MAX_FLEET);
+                return -1;
             }
-            printf(" %c ", ch);
+            Ship *ship = &cfg->fleet[cfg->shipCount++];
+            size_t len = strcspn(p, ",");
+            const char *colon = memchr(p, ':', len);
+            const char *num = colon ? colon + 1 : p;
+            char *end;
+            ship->size = (int)strtol(num, &end, 10);
+            if (end == num || end != p + len) {
+                fprintf(stderr, "Invalid fleet: %s (use sizes like 5,4,3,3,2)\n", fleet);
+                return -1;
+            }
+            if (colon) snprintf(ship->name, sizeof(ship->name), "%.*s", (int)(colon - p), p);
+            else       snprintf(ship->name, sizeof(ship->name), "%s", DefaultShipName(ship->size));
+            p += len;
+            if (*p == ',') ++p;
         }
-        printf("\n");
     }
+
+    int longest = cfg->rows > cfg->cols ? cfg->rows : cfg->cols;
+    long long cells = 0;
+    for (int s = 0; s < cfg->shipCount; ++s) {
+        if (cfg->fleet[s].size < 1 || cfg->fleet[s].size > longest) {
+            fprintf(stderr, "Ship size %d does not fit a %dx%d board\n", cfg->fleet[s].size, cfg->rows, cfg->cols);
+            return -1;
+        }
+        cells += cfg->fleet[s].size;
+    }
+    /* Random placement needs room to move */
+    long long area = (long long)cfg->rows * cfg->cols;
+    if ((long long)cfg->shipCount * cfg->fleets > SPARSE_MAX_SHIPS) {
+        fprintf(stderr, "At most %d ships on a board\n", SPARSE_MAX_SHIPS);
+        return -1;
+    }
+    if (cfg->shipCount == 0 || cells * cfg->fleets > area / 2) {
+        fprintf(stderr, "The fleet must cover between 1 and half of the %lld cells\n", area);
+        return -1;
+    }
+
+    cfg->custom = cfg->rows != GRID_SIZE || cfg->cols != GRID_SIZE || cfg->shipCount != NUM_SHIPS;
+    for (int s = 0; s < cfg->shipCount && !cfg->custom; ++s) {
+        if (cfg->fleet[s].size != ships[s].size) cfg->custom = 1;
+    }
+    /* Standard sizes with new names: keep the 10x10 code, use the names */
+    if (!cfg->custom) memcpy(ships, cfg->fleet, sizeof(ships));
+    return 0;
 }
 
-/* Show your ship board and your shot board */
-void DisplayWorld(GameState *game) {
-    printf("\n=== Your Ships ===\n");
-    PrintGrid(game->playerShips, 0);
-    printf("\n=== Your Shots ===\n");
-    PrintGrid(game->playerShots, 1);
+/* Read a typed cell: a row letter and a column number, e.g. A5 or C42.
+   Returns 0, -1 if the text is not a cell, -2 if it is off the board. */
+int ParseCell(const char *input, int rows, int cols, int *row, int *col) {
+    if (!isalpha((unsigned char)input[0]) || !isdigit((unsigned char)input[1])) return -1;
+    int c = 0;
+    const char *p = input + 1;
+    for (; isdigit((unsigned char)*p); ++p) {
+        if (c <= WIDE_MAX_COLS) c = c * 10 + (*p - '0');
+    }
+    while (isspace((unsigned char)*p)) ++p;
+    if (*p) return -1;
+    *row = toupper((unsigned char)input[0]) - 'A';
+    *col = c;
+    return *row < rows && c < cols ? 0 : -2;
 }
 
-/* Ship placement */
+/* Bitboard helpers */
 
-/* Put all ships on the grid in random spots without overlapping */
-void RandomlyPlaceShips(CellStatus **grid) {
-    for (int s = 0; s < NUM_SHIPS; ++s) {
-        int placed = 0;
-        int size = ships[s].size;
-        while (!placed) {
-            int r = rand() % GRID_SIZE;
-            int c = rand() % GRID_SIZE;
-            int vertical = rand() % 2;
-            int fits = 1;
-            if (vertical) {
-                if (r + size > GRID_SIZE) { continue; }
-                for (int i = 0; i < size; ++i) {
-                    if (grid[r+i][c] != EMPTY) { fits = 0; break; }
-                }
-                if (fits) {
-                    for (int i = 0; i < size; ++i) grid[r+i][c] = SHIP;
-                    placed = 1;
-                }
-            } else {
-                if (c + size > GRID_SIZE) { continue; }
-                for (int i = 0; i < size; ++i) {
-                    if (grid[r][c+i] != EMPTY) { fits = 0; break; }
-                }
-                if (fits) {
-                    for (int i = 0; i < size; ++i) grid[r][c+i] = SHIP;
-                    placed = 1;
-                }
-            }
-        }
-    }
+/* Turn (row, col) into a bit number */
+static inline int CellIndex(int row, int col) {
+    return row * GRID_SIZE + col;
 }
 
-/* Single-player setup and cleanup */
+/* Return 1 if bit idx is set */
+static inline int BitboardTest(Bitboard b, int idx) {
+    return idx < 64 ? (int)((b.lo >> idx) & 1u) : (int)((b.hi >> (idx - 64)) & 1u);
+}
 
-/* Make a single-player game: make grids and place ships for player */
-GameState *SetupSinglePlayer(void) {
-    GameState *game = malloc(sizeof(GameState));
-    if (!game) { perror("malloc"); exit(EXIT_FAILURE); }
-    game->playerShips = AllocateGrid();
-    game->playerShots = AllocateGrid();
+/* Set bit idx */
+static inline void BitboardSet(Bitboard *b, int idx) {
+    if (idx < 64) b->lo |= 1ULL << idx;
+    else          b->hi |= 1ULL << (idx - 64);
+}
 
-    /* For single-player we only store player grids here.
-       The computer's grid is handled separately in main. */
-    RandomlyPlaceShips(game->playerShips); /* put player ships randomly */
+static inline Bitboard BitboardOr(Bitboard a, Bitboard b) {
+    Bitboard r = { a.lo | b.lo, a.hi | b.hi };
+    return r;
+}
 
-    return game;
+static inline Bitboard BitboardAnd(Bitboard a, Bitboard b) {
+    Bitboard r = { a.lo & b.lo, a.hi & b.hi };
+    return r;
 }
 
-/* Free memory for a single-player game */
-void TeardownSinglePlayer(GameState *game) {
-    if (!game) return;
-    FreeGrid(game->playerShips);
-    FreeGrid(game->playerShots);
-    free(game);
+/* Bits in a that are not in b */
+static inline Bitboard BitboardAndNot(Bitboard a, Bitboard b) {
+    Bitboard r = { a.lo & ~b.lo, a.hi & ~b.hi };
+    return r;
 }
 
-/* Single-player helper functions */
+/* Return 1 if any bit is set */
+static inline int BitboardAny(Bitboard b) {
+    return (b.lo | b.hi) != 0;
+}
 
-/* Return 1 if no SHIP cells are left on this grid, else 0 */
-int GridAllShipsDestroyed(CellStatus **grid) {
-    for (int r = 0; r < GRID_SIZE; ++r)
-        for (int c = 0; c < GRID_SIZE; ++c)
-            if (grid[r][c] == SHIP) return 0;
-    return 1;
+/* Return 1 if both have the same bits */
+static inline int BitboardEqual(Bitboard a, Bitboard b) {
+    return a.lo == b.lo && a.hi == b.hi;
 }
 
-/* Mark a shot on the grid and say if it was a hit (1) or miss (0) */
-int ApplyShotToGrid(CellStatus **grid, int row, int col) {
-    if (grid[row][col] == SHIP) {
-        grid[row][col] = HIT;
-        return 1;
-    } else {
-        if (grid[row][col] == EMPTY) grid[row][col] = MISS;
-        return 0;
+/* Number of set bits */
+static inline int BitboardCount(Bitboard b) {
+    return __builtin_popcountll(b.lo) + __builtin_popcountll(b.hi);
+}
+
+/* Remove the lowest set bit and return its number */
+static inline int BitboardPopLowest(Bitboard *b) {
+    if (b->lo) {
+        int idx = __builtin_ctzll(b->lo);
+        b->lo &= b->lo - 1;
+        return idx;
     }
+    int idx = 64 + __builtin_ctzll(b->hi);
+    b->hi &= b->hi - 1;
+    return idx;
 }
 
-/* Networking helper functions */
+/* Bitboard with the lowest n bits set (0 <= n <= 128) */
+static inline Bitboard BitboardFromMask(int n) {
+    Bitboard b;
+    b.lo = n >= 64 ? ~0ULL : (n > 0 ? ~0ULL >> (64 - n) : 0);
+    b.hi = n >= 128 ? ~0ULL : (n > 64 ? ~0ULL >> (128 - n) : 0);
+    return b;
+}
 
-/* Send the whole buffer over the socket */
-int SendAll(int sockfd, const char *buffer, size_t length) {
-    size_t total_sent = 0;
-    while (total_sent < length) {
-        ssize_t sent = send(sockfd, buffer + total_sent, length - total_sent, 0);
-        if (sent <= 0) return -1;
-        total_sent += (size_t)sent;
-    }
-    return 0;
+/* Random numbers */
+
+/* xoshiro256** generator. Every thread (and every simulated game) owns its
+   own Rng, so there is no shared state like rand() has. */
+typedef struct {
+    uint64_t s[4];
+} Rng;
+
+/* Generator used by the interactive modes */
+static Rng gameRng;
+
+static inline uint64_t RotateLeft(uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
 }
 
-/* Read one line (ending with '\n') from the socket.
-   outbuf has space maxlen. Returns number of bytes or -1. */
-ssize_t ReceiveLine(int sockfd, char *outbuf, size_t maxlen) {
-    size_t idx = 0;
-    while (idx + 1 < maxlen) {
-        char ch;
-        ssize_t n = recv(sockfd, &ch, 1, 0);
-        if (n <= 0) return -1; /* no data: closed or error */
-        outbuf[idx++] = ch;
-        if (ch == '\n') break;
-    }
-    outbuf[idx] = '\0';
-    return (ssize_t)idx;
+/* splitmix64 step, used to spread one seed over the xoshiro state */
+static inline uint64_t SplitMix64(uint64_t *state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
 }
 
-/* Send formatted text plus a newline to the socket */
-int SendLine(int sockfd, const char *fmt, ...) {
-    char buffer[LINE_BUF];
-    va_list ap;
-    va_start(ap, fmt);
-    int n = vsnprintf(buffer, sizeof(buffer), fmt, ap);
-    va_end(ap);
-    if (n < 0) return -1;
-    if ((size_t)n >= sizeof(buffer) - 1) return -1;
-    /* add newline if missing */
-    if (buffer[n-1] != '\n') {
-        if (n + 1 >= (int)sizeof(buffer)) return -1;
-        buffer[n] = '\n';
-        buffer[n+1] = '\0';
-        n++;
-    }
-    return SendAll(sockfd, buffer, (size_t)n);
+/* Seed a generator from one 64-bit number */
+void RngSeed(Rng *rng, uint64_t seed) {
+    for (int i = 0; i < 4; ++i) rng->s[i] = SplitMix64(&seed);
 }
 
-/* Two-player: shots and replies */
+/* Next 64 random bits */
+static inline uint64_t RngNext(Rng *rng) {
+    uint64_t *s = rng->s;
+    uint64_t result = RotateLeft(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = RotateLeft(s[3], 45);
+    return result;
+}
+
+/* Random number in [0, n) without a division (multiply-shift) */
+static inline int RngBelow(Rng *rng, int n) {
+    return (int)(((RngNext(rng) >> 32) * (uint64_t)n) >> 32);
+}
+
+/* Zobrist keys */
 
 /*
- * Simple text protocol:
- * - To shoot:   "SHOT r c\n"
- * - Reply:      "RESULT HIT\n" or "RESULT MISS\n"
- * - To quit:    "QUIT\n"
- *
- * Server takes the first shot.
+ * Board.key identifies what a shooter knows about a board: every hit,
+ * every miss, and every sunk ship with its cells. It is the XOR of one
+ * 64-bit key per fact, so each shot updates it with one or two XORs in
+ * ApplyShotToGrid / RecordShot and equal knowledge always gives the same
+ * key. The per-fact keys are SplitMix64 outputs of the fact's number,
+ * which is as good as a table of random numbers and needs no setup.
  */
 
-/* Answer a shot from the other player and tell them hit or miss */
-int HandleIncomingShotAndRespond(GameState *localGame, int row, int col, int sockfd) {
-    int hit = ApplyShotToGrid(localGame->playerShips, row, col);
-    if (hit) SendLine(sockfd, "RESULT HIT");
-    else     SendLine(sockfd, "RESULT MISS");
-    return hit;
+typedef enum { ZOBRIST_HIT, ZOBRIST_MISS, ZOBRIST_SUNK_CELL, ZOBRIST_SUNK_SHIP, ZOBRIST_KIND } ZobristFact;
+
+static inline uint64_t ZobristKey(ZobristFact fact, int n) {
+    uint64_t x = (uint64_t)fact * GRID_CELLS + (uint64_t)n;
+    return SplitMix64(&x);
 }
 
-/* Shoot at the other player and update your shot grid */
-int FireShotAtOpponent(GameState *localGame, int row, int col, int sockfd) {
-    if (localGame->playerShots[row][col] != EMPTY) {
-        printf("You already fired at %c%d. Choose a different target.\n", 'A'+row, col);
-        return -2;
+/* Key of a board computed from scratch (ApplyShotToGrid keeps it current) */
+uint64_t BoardKey(const Board *grid) {
+    uint64_t key = 0;
+    Bitboard cells = grid->hits;
+    while (BitboardAny(cells)) key ^= ZobristKey(ZOBRIST_HIT, BitboardPopLowest(&cells));
+    cells = grid->misses;
+    while (BitboardAny(cells)) key ^= ZobristKey(ZOBRIST_MISS, BitboardPopLowest(&cells));
+    cells = grid->sunk;
+    while (BitboardAny(cells)) key ^= ZobristKey(ZOBRIST_SUNK_CELL, BitboardPopLowest(&cells));
+    for (int s = 0; s < NUM_SHIPS; ++s) {
+        if (BitboardAny(grid->fleet[s]) && !(grid->afloat & (1u << s))) key ^= ZobristKey(ZOBRIST_SUNK_SHIP, s);
     }
+    return key;
+}
 
-    if (SendLine(sockfd, "SHOT %d %d", row, col) < 0) { perror("send"); return -1; }
+/* Memory helpers */
 
-    char line[LINE_BUF];
-    if (ReceiveLine(sockfd, line, sizeof(line)) < 0) {
-        printf("Connection closed while waiting for result.\n");
-        return -1;
-    }
+/* Heap calls made by the game code, reported by the simulator.
+   Kept per thread so simulation workers do not fight over them. */
+static _Thread_local unsigned long allocCount = 0;
+static _Thread_local unsigned long freeCount = 0;
 
-    if (strncmp(line, "RESULT", 6) == 0) {
-        if (strstr(line, "HIT")) {
-            localGame->playerShots[row][col] = HIT;
-            printf("You hit opponent at %c%d!\n", 'A'+row, col);
-            return 1;
-        } else {
-            localGame->playerShots[row][col] = MISS;
-            printf("You missed at %c%d.\n", 'A'+row, col);
-            return 0;
-        }
-    } else if (strncmp(line, "QUIT", 4) == 0) {
-        printf("Opponent quit. You win by default.\n");
-        return -1;
-    } else {
-        printf("Unexpected response: %s\n", line);
-        return -1;
+/* Make an empty board (no ships, no shots) */
+Board *AllocateGrid(void) {
+    Board *grid = calloc(1, sizeof(Board));
+    if (!grid) { perror("calloc"); exit(EXIT_FAILURE); }
+    allocCount++;
+    return grid;
+}
+
+/* Free a board made by AllocateGrid */
+void FreeGrid(Board *grid) {
+    if (!grid) return;
+    freeCount++;
+    free(grid);
+}
+
+/* Read one cell back as a CellStatus */
+CellStatus GridCell(const Board *grid, int row, int col) {
+    int idx = CellIndex(row, col);
+    if (BitboardTest(grid->hits, idx))   return HIT;
+    if (BitboardTest(grid->misses, idx)) return MISS;
+    if (BitboardTest(grid->ships, idx))  return SHIP;
+    return EMPTY;
+}
+
+/* Return 1 if this cell was already shot (hit or miss) */
+int GridAlreadyShot(const Board *grid, int row, int col) {
+    return BitboardTest(BitboardOr(grid->hits, grid->misses), CellIndex(row, col));
+}
+
+/* Write a shot result into a shot board */
+void RecordShot(Board *grid, int row, int col, int hit) {
+    int idx = CellIndex(row, col);
+    Bitboard *set = hit ? &grid->hits : &grid->misses;
+    if (BitboardTest(*set, idx)) return;
+    BitboardSet(set, idx);
+    grid->key ^= ZobristKey(hit ? ZOBRIST_HIT : ZOBRIST_MISS, idx);
+}
+
+/* Put ships[s] on the grid on the cells in mask */
+void BoardAddShip(Board *grid, int s, Bitboard mask) {
+    grid->ships = BitboardOr(grid->ships, mask);
+    grid->fleet[s] = mask;
+    grid->hitsLeft[s] = (uint8_t)BitboardCount(mask);
+    grid->afloat |= (uint8_t)(1u << s);
+    grid->shipsLeft++;
+    while (BitboardAny(mask)) grid->shipAt[BitboardPopLowest(&mask)] = (uint8_t)(s + 1);
+}
+
+/* Forget every shot on the grid but keep the fleet */
+void BoardClearShots(Board *grid) {
+    Bitboard none = { 0, 0 };
+    grid->hits = grid->misses = grid->sunk = none;
+    grid->key = 0;
+    grid->afloat = grid->shipsLeft = 0;
+    for (int s = 0; s < NUM_SHIPS; ++s) {
+        if (!BitboardAny(grid->fleet[s])) continue;
+        grid->hitsLeft[s] = (uint8_t)BitboardCount(grid->fleet[s]);
+        grid->afloat |= (uint8_t)(1u << s);
+        grid->shipsLeft++;
     }
 }
 
-/* Two-player main loop */
+/* Drawing the boards */
 
-/* Play two-player game on this socket.
-   If amServer is 1, this side shoots first. */
-void PlayTwoPlayer(GameState *localGame, int sockfd, int amServer) {
-    char input[LINE_BUF];
+/*
+ * Everything is drawn into a FrameBuffer first and written with a single
+ * write(), instead of one printf per cell.
+ *
+ * With --ansi the two boards sit side by side at the top of the screen and
+ * stay there: the rest of the screen is a scrolling region for messages
+ * and prompts. After the first frame only the cells that changed are
+ * redrawn, each with a cursor-move escape, and the cursor is put back where
+ * the messages were.
+ */
 
-    printf("Two-player game started. Type 'quit' to leave and send QUIT.\n");
-    if (amServer) printf("You are server: you shoot first.\n");
-    else          printf("You are client: opponent shoots first.\n");
+#define FRAME_MAX 16384 /* two 26x99 boards */
 
-    while (1) {
-        if (amServer) {
-            /* Your turn to shoot */
-            DisplayWorld(localGame);
-            printf("\nYour turn (format A5). Type 'quit' to quit: ");
-            if (!fgets(input, sizeof(input), stdin)) {
-                printf("stdin closed.\n");
-                break;
-            }
-            input[strcspn(input, "\n")] = '\0';
-            if (strcasecmp(input, "quit") == 0) {
-                SendLine(sockfd, "QUIT");
-                printf("You quit. Closing connection.\n");
-                break;
-            }
-            if (strlen(input) < 2) {
-                printf("Invalid input.\n");
-                continue;
-            }
-            int row = toupper((unsigned char)input[0]) - 'A';
-            int col = input[1] - '0';
-            if (row < 0 || row >= GRID_SIZE || col < 0 || col >= GRID_SIZE) {
-                printf("Coordinates out of range.\n");
-                continue;
-            }
+typedef struct {
+    size_t len;
+    char data[FRAME_MAX];
+} FrameBuffer;
 
-            int res = FireShotAtOpponent(localGame, row, col, sockfd);
-            if (res == -1) break;    /* connection error or opponent quit */
-            if (res == -2) continue; /* already fired there */
+/* Add formatted text to the frame (silently cut off if it is full) */
+void FrameAppendf(FrameBuffer *fb, const char *fmt, ...) {
+    size_t room = sizeof(fb->data) - fb->len;
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(fb->data + fb->len, room, fmt, ap);
+    va_end(ap);
+    if (n < 0) return;
+    fb->len += (size_t)n < room ? (size_t)n : room - 1;
+}
 
-            /* Now wait for their shot */
-            char line[LINE_BUF];
-            if (ReceiveLine(sockfd, line, sizeof(line)) <= 0) {
-                printf("Connection closed by opponent.\n");
-                break;
-            }
-            if (strncmp(line, "SHOT", 4) == 0) {
-                int r, c;
-                if (sscanf(line, "SHOT %d %d", &r, &c) != 2) {
-                    printf("Malformed SHOT received.\n");
-                    break;
-                }
-                int hit = ApplyShotToGrid(localGame->playerShips, r, c);
-                if (hit) SendLine(sockfd, "RESULT HIT");
-                else     SendLine(sockfd, "RESULT MISS");
-                if (hit) printf("Opponent hit you at %c%d.\n", 'A'+r, c);
-                else     printf("Opponent missed at %c%d.\n", 'A'+r, c);
-                if (GridAllShipsDestroyed(localGame->playerShips)) {
-                    printf("All your ships destroyed. You lose.\n");
-                    break;
-                }
-            } else if (strncmp(line, "QUIT", 4) == 0) {
-                printf("Opponent quit. You win.\n");
-                break;
-            } else {
-                printf("Unexpected message from opponent: %s\n", line);
-                break;
-            }
-        } else {
-            /* Client: wait for server to shoot first */
-            char line[LINE_BUF];
-            if (ReceiveLine(sockfd, line, sizeof(line)) <= 0) {
-                printf("Connection closed by opponent.\n");
-                break;
-            }
-            if (strncmp(line, "SHOT", 4) == 0) {
-                int r, c;
-                if (sscanf(line, "SHOT %d %d", &r, &c) != 2) {
-                    printf("Malformed SHOT received.\n");
-                    break;
-                }
-                int hit = ApplyShotToGrid(localGame->playerShips, r, c);
-                if (hit) SendLine(sockfd, "RESULT HIT");
-                else     SendLine(sockfd, "RESULT MISS");
-                if (hit) printf("Opponent hit you at %c%d.\n", 'A'+r, c);
-                else     printf("Opponent missed at %c%d.\n", 'A'+r, c);
-                if (GridAllShipsDestroyed(localGame->playerShips)) {
-                    printf("All your ships destroyed. You lose.\n");
-                    break;
-                }
-            } else if (strncmp(line, "QUIT", 4) == 0) {
-                printf("Opponent quit. You win.\n");
-                break;
-            } else {
-                printf("Unexpected message from opponent: %s\n", line);
-                break;
-            }
+/* Write the frame to stdout in one go */
+void FrameFlush(FrameBuffer *fb) {
+    fflush(stdout); /* keep order with earlier printf output */
+    size_t done = 0;
+    while (done < fb->len) {
+        ssize_t n = write(STDOUT_FILENO, fb->data + done, fb->len - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        done += (size_t)n;
+    }
+    fb->len = 0;
+}
 
-            /* Now you shoot */
-            DisplayWorld(localGame);
-            printf("\nYour turn (format A5). Type 'quit' to quit: ");
-            if (!fgets(input, sizeof(input), stdin)) {
-                printf("stdin closed.\n");
-                break;
-            }
-            input[strcspn(input, "\n")] = '\0';
-            if (strcasecmp(input, "quit") == 0) {
-                SendLine(sockfd, "QUIT");
-                printf("You quit. Closing connection.\n");
-                break;
-            }
-            if (strlen(input) < 2) {
-                printf("Invalid input.\n");
-                continue;
-            }
-            int row = toupper((unsigned char)input[0]) - 'A';
-            int col = input[1] - '0';
-            if (row < 0 || row >= GRID_SIZE || col < 0 || col >= GRID_SIZE) {
-                printf("Coordinates out of range.\n");
-                continue;
-            }
+/* Character shown for one cell */
+static inline char CellSymbol(const Board *grid, int idx, int hideShips) {
+    if (BitboardTest(grid->hits, idx))   return 'X';
+    if (BitboardTest(grid->misses, idx)) return 'o';
+    if (!hideShips && BitboardTest(grid->ships, idx)) return 'S';
+    return '.';
+}
 
-            int res = FireShotAtOpponent(localGame, row, col, sockfd);
-            if (res == -1) break;
-            if (res == -2) continue;
+/* Draw one grid into the frame; if hideShips is 1 we do not show S for ships */
+void RenderGrid(FrameBuffer *fb, const Board *grid, int hideShips) {
+    char *out = fb->data + fb->len;
+    size_t need = 4 + 3 * GRID_SIZE + 1 + GRID_SIZE * (3 + 3 * GRID_SIZE + 1);
+    if (sizeof(fb->data) - fb->len < need + 1) return;
+
+    memcpy(out, "    ", 4);
+    out += 4;
+    for (int c = 0; c < GRID_SIZE; ++c) {
+        *out++ = c < 10 ? ' ' : (char)('0' + c / 10);
+        *out++ = (char)('0' + c % 10);
+        *out++ = ' ';
+    }
+    *out++ = '\n';
+    for (int r = 0; r < GRID_SIZE; ++r) {
+        *out++ = (char)('A' + r);
+        *out++ = ' ';
+        *out++ = ' ';
+        for (int c = 0; c < GRID_SIZE; ++c) {
+            *out++ = ' ';
+            *out++ = CellSymbol(grid, CellIndex(r, c), hideShips);
+            *out++ = ' ';
         }
+        *out++ = '\n';
     }
+    fb->len = (size_t)(out - fb->data);
+    fb->data[fb->len] = '\0';
+}
 
-    close(sockfd);
-    printf("Two-player session ended.\n");
+/* Print one grid; if hideShips is 1 we do not show S for ships */
+void PrintGrid(const Board *grid, int hideShips) {
+    FrameBuffer fb;
+    fb.len = 0;
+    RenderGrid(&fb, grid, hideShips);
+    FrameFlush(&fb);
 }
 
-/* Server and client setup */
+/* ANSI side-by-side screen */
 
-/* Run as server: open port, accept one player, then start game */
-int RunServerMode(int port) {
-    int listenfd = socket(AF_INET, SOCK_STREAM, 0);
-    if (listenfd < 0) { perror("socket"); return -1; }
+#define ANSI_BOARD_WIDTH (4 + 3 * GRID_SIZE + 4) /* one board plus a gap */
+#define ANSI_BOARD_ROWS (2 + GRID_SIZE + 1)      /* title, header, rows, blank */
 
-    int opt = 1;
-    if (setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
-        perror("setsockopt");
+/* --ansi: redraw only changed cells at fixed positions */
+static int ansiMode = 0;
+
+typedef struct {
+    int drawn;                        /* first full frame is on screen */
+    char shown[2][GRID_CELLS];        /* symbols currently on screen */
+} AnsiScreen;
+
+static AnsiScreen ansiScreen;
+
+/* Put the terminal back to one normal scrolling region */
+static void AnsiRestoreScreen(void) {
+    if (ansiScreen.drawn) {
+        printf("\x1b[r");
+        fflush(stdout);
     }
+}
 
-    struct sockaddr_in addr;
-    memset(&addr, 0, sizeof(addr));
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(port);
-    addr.sin_addr.s_addr = INADDR_ANY;
+/* Number of rows on the terminal, or 24 if we cannot tell */
+static int TerminalRows(void) {
+    struct winsize ws;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_row > ANSI_BOARD_ROWS + 2) {
+        return ws.ws_row;
+    }
+    return 24;
+}
 
-    if (bind(listenfd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
-        perror("bind");
-        close(listenfd);
-        return -1;
+/* First frame: clear the screen, draw both boards, and make the rows
+   below them the only part that scrolls */
+static void AnsiDrawFull(FrameBuffer *fb, const Board *boards[2], const int hide[2]) {
+    static const char *titles[2] = { "=== Your Ships ===", "=== Your Shots ===" };
+    FrameAppendf(fb, "\x1b[H\x1b[2J");
+    for (int b = 0; b < 2; ++b) {
+        int x = 1 + b * ANSI_BOARD_WIDTH;
+        FrameAppendf(fb, "\x1b[1;%dH%s\x1b[2;%dH   ", x, titles[b], x);
+        for (int c = 0; c < GRID_SIZE; ++c) FrameAppendf(fb, "%2d ", c);
+        for (int r = 0; r < GRID_SIZE; ++r) {
+            FrameAppendf(fb, "\x1b[%d;%dH%c  ", 3 + r, x, 'A' + r);
+            for (int c = 0; c < GRID_SIZE; ++c) {
+                char ch = CellSymbol(boards[b], CellIndex(r, c), hide[b]);
+                ansiScreen.shown[b][CellIndex(r, c)] = ch;
+                FrameAppendf(fb, " %c ", ch);
+            }
+        }
     }
+    FrameAppendf(fb, "\x1b[%d;%dr\x1b[%d;1H", ANSI_BOARD_ROWS + 1, TerminalRows(), ANSI_BOARD_ROWS + 1);
+    ansiScreen.drawn = 1;
+    atexit(AnsiRestoreScreen);
+}
 
-    if (listen(listenfd, 1) < 0) {
-        perror("listen");
-        close(listenfd);
-        return -1;
+/* Later frames: rewrite only the cells whose symbol changed */
+static void AnsiDrawDiff(FrameBuffer *fb, const Board *boards[2], const int hide[2]) {
+    FrameAppendf(fb, "\x1b" "7"); /* save cursor */
+    for (int b = 0; b < 2; ++b) {
+        for (int idx = 0; idx < GRID_CELLS; ++idx) {
+            char ch = CellSymbol(boards[b], idx, hide[b]);
+            if (ch == ansiScreen.shown[b][idx]) continue;
+            ansiScreen.shown[b][idx] = ch;
+            int row = 3 + idx / GRID_SIZE;
+            int col = 1 + b * ANSI_BOARD_WIDTH + 4 + 3 * (idx % GRID_SIZE);
+            FrameAppendf(fb, "\x1b[%d;%dH%c", row, col, ch);
+        }
     }
+    FrameAppendf(fb, "\x1b" "8"); /* back to the message area */
+}
+
+/* Show your ship board and your shot board */
+void DisplayWorld(GameState *game) {
+    FrameBuffer fb;
+    fb.len = 0;
+    if (ansiMode) {
+        const Board *boards[2] = { &game->playerShips, &game->playerShots };
+        const int hide[2] = { 0, 1 };
+        if (!ansiScreen.drawn) AnsiDrawFull(&fb, boards, hide);
+        else                   AnsiDrawDiff(&fb, boards, hide);
+    } else {
+        FrameAppendf(&fb, "\n=== Your Ships ===\n");
+        RenderGrid(&fb, &game->playerShips, 0);
+        FrameAppendf(&fb, "\n=== Your Shots ===\n");
+        RenderGrid(&fb, &game->playerShots, 1);
+    }
+    FrameFlush(&fb);
+}
+
+/* Ship placement */
+
+/* Cells covered by a ship of this size at (r, c), going down if vertical */
+Bitboard ShipMask(int r, int c, int size, int vertical) {
+    Bitboard mask = { 0, 0 };
+    for (int i = 0; i < size; ++i) {
+        BitboardSet(&mask, vertical ? CellIndex(r + i, c) : CellIndex(r, c + i));
+    }
+    return mask;
+}
+
+/*
+ * Every way a ship of each size can lie on the board is built once into
+ * placements[size], so a ship is always drawn from legal spots only.
+ *
+ * A fleet draw picks one mask per ship straight from its table and keeps
+ * the fleet if no two ships overlap. Every legal fleet is then exactly as
+ * likely as any other; with the standard fleet about 39% of draws are kept
+ * and one draw is five lookups and ANDs (~60 ns per fleet).
+ *
+ * PLACE_FAST (the default) caps that at FLEET_DRAWS tries and then falls
+ * back to the sequential sampler, which keeps the masks that miss the ships
+ * already down and draws one of them: at most MAX_PLACEMENTS checks per
+ * ship, so the work is bounded (~1.6 us). PLACE_UNIFORM never falls back.
+ */
+
+#define MAX_PLACEMENTS (2 * GRID_CELLS)
+#define FLEET_DRAWS 16
+
+typedef enum { PLACE_FAST, PLACE_UNIFORM } PlacementMode;
+
+/* How fleets are drawn; --placement uniform picks the exact sampler */
+static PlacementMode placementMode = PLACE_FAST;
+
+/* placements[size] holds every legal mask of a ship that long */
+static Bitboard placements[GRID_SIZE + 1][MAX_PLACEMENTS];
+static int placementCount[GRID_SIZE + 1];
+static pthread_once_t placementsOnce = PTHREAD_ONCE_INIT;
+
+static void BuildPlacements(void) {
+    for (int size = 1; size <= GRID_SIZE; ++size) {
+        int n = 0;
+        for (int vertical = 0; vertical < 2; ++vertical) {
+            if (size == 1 && vertical) break; /* one cell looks the same both ways */
+            for (int r = 0; r < GRID_SIZE; ++r) {
+                for (int c = 0; c < GRID_SIZE; ++c) {
+                    if (vertical ? r + size > GRID_SIZE : c + size > GRID_SIZE) continue;
+                    placements[size][n++] = ShipMask(r, c, size, vertical);
+                }
+            }
+        }
+        placementCount[size] = n;
+    }
+}
+
+/* Build the placement tables once (safe to call from any thread) */
+void InitPlacements(void) {
+    pthread_once(&placementsOnce, BuildPlacements);
+}
+
+/* Draw whole fleets until one has no overlaps, at most maxDraws times
+   (0 = no limit). Returns 1 if a fleet was placed. */
+static int PlaceFleetUniform(Board *grid, Rng *rng, int maxDraws) {
+    Bitboard chosen[NUM_SHIPS];
+    for (int draw = 0; maxDraws == 0 || draw < maxDraws; ++draw) {
+        Bitboard fleet = grid->ships;
+        int s;
+        for (s = 0; s < NUM_SHIPS; ++s) {
+            int size = ships[s].size;
+            Bitboard p = placements[size][RngBelow(rng, placementCount[size])];
+            if (BitboardAny(BitboardAnd(fleet, p))) break;
+            fleet = BitboardOr(fleet, p);
+            chosen[s] = p;
+        }
+        if (s == NUM_SHIPS) {
+            for (s = 0; s < NUM_SHIPS; ++s) BoardAddShip(grid, s, chosen[s]);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Place ships one at a time, each drawn from the spots still free */
+static void PlaceFleetSequential(Board *grid, Rng *rng) {
+    Bitboard fleet = grid->ships;
+    Bitboard chosen[NUM_SHIPS];
+    uint16_t fits[MAX_PLACEMENTS];
+    for (int s = 0; s < NUM_SHIPS; ++s) {
+        int size = ships[s].size;
+        const Bitboard *p = placements[size];
+        int n = 0;
+        for (int i = 0; i < placementCount[size]; ++i) {
+            if (!BitboardAny(BitboardAnd(fleet, p[i]))) fits[n++] = (uint16_t)i;
+        }
+        if (n == 0) {
+            /* Earlier ships boxed this one out: start the fleet over */
+            fleet = grid->ships;
+            s = -1;
+            continue;
+        }
+        chosen[s] = p[fits[RngBelow(rng, n)]];
+        fleet = BitboardOr(fleet, chosen[s]);
+    }
+    for (int s = 0; s < NUM_SHIPS; ++s) BoardAddShip(grid, s, chosen[s]);
+}
+
+/* Put all ships on the grid in random spots without overlapping */
+void RandomlyPlaceShips(Board *grid, Rng *rng) {
+    InitPlacements();
+    if (placementMode == PLACE_UNIFORM) {
+        PlaceFleetUniform(grid, rng, 0);
+        return;
+    }
+    if (!PlaceFleetUniform(grid, rng, FLEET_DRAWS)) PlaceFleetSequential(grid, rng);
+}
+
+/* Single-player setup and cleanup */
+
+/* Start a game in memory the caller owns: clear both boards and place
+   the player's ships. Does no heap calls. */
+void InitGame(GameState *game, Rng *rng) {
+    memset(game, 0, sizeof(*game));
+    RandomlyPlaceShips(&game->playerShips, rng); /* put player ships randomly */
+}
+
+/* Make a single-player game: make grids and place ships for player */
+GameState *SetupSinglePlayer(Rng *rng) {
+    GameState *game = malloc(sizeof(GameState));
+    if (!game) { perror("malloc"); exit(EXIT_FAILURE); }
+    allocCount++;
+
+    /* For single-player we only store player grids here.
+       The computer's grid is handled separately in main. */
+    InitGame(game, rng);
+    return game;
+}
+
+/* Free memory for a single-player game */
+void TeardownSinglePlayer(GameState *game) {
+    if (!game) return;
+    freeCount++;
+    free(game);
+}
+
+/* Packed boards */
+
+/*
+ * A Board is built for playing: bitboards, a fleet and a ship index per
+ * cell, 264 bytes. To keep very many games in memory (parked
+ * matches, caches, test corpora) a game is stored packed instead: every
+ * cell of each side's own board as a 2-bit CellStatus (25 bytes a side)
+ * plus each ship as one byte, first cell * 2 + vertical, the same code as
+ * in replays. A whole two-sided game is 60 bytes and unpacks into
+ * playable GameStates. HIT always means a ship cell that was hit.
+ * The packed form is only for storage; shots are always played on Boards.
+ */
+
+#define PACKED_BYTES ((GRID_CELLS * 2 + 7) / 8)
+
+typedef struct {
+    uint8_t cells[PACKED_BYTES];  /* cell i in bits 2*(i%4) of byte i/4 */
+} PackedBoard;
+
+typedef struct {
+    PackedBoard board[2];          /* each side's own ships and the shots at them */
+    uint8_t fleet[2][NUM_SHIPS];   /* first cell * 2 + vertical */
+} PackedGame;
+
+#define PACKED_NO_SHIP 0xFF        /* fleet byte of a ship that is not placed */
+
+/* Bits 0..31 of x moved to the even bits 0, 2, .., 62 */
+static inline uint64_t SpreadBits(uint32_t v) {
+    uint64_t x = v;
+    x = (x | (x << 16)) & 0x0000FFFF0000FFFFULL;
+    x = (x | (x << 8))  & 0x00FF00FF00FF00FFULL;
+    x = (x | (x << 4))  & 0x0F0F0F0F0F0F0F0FULL;
+    x = (x | (x << 2))  & 0x3333333333333333ULL;
+    x = (x | (x << 1))  & 0x5555555555555555ULL;
+    return x;
+}
+
+/* The even bits of x gathered into 32 bits; undoes SpreadBits */
+static inline uint32_t GatherBits(uint64_t x) {
+    x &= 0x5555555555555555ULL;
+    x = (x | (x >> 1))  & 0x3333333333333333ULL;
+    x = (x | (x >> 2))  & 0x0F0F0F0F0F0F0F0FULL;
+    x = (x | (x >> 4))  & 0x00FF00FF00FF00FFULL;
+    x = (x | (x >> 8))  & 0x0000FFFF0000FFFFULL;
+    x = (x | (x >> 16)) & 0x00000000FFFFFFFFULL;
+    return (uint32_t)x;
+}
+
+static inline uint32_t BitboardWord32(Bitboard b, int k) {
+    uint64_t w = k < 2 ? b.lo : b.hi;
+    return (uint32_t)(w >> (32 * (k & 1)));
+}
+
+/* Pack a board's ships, hits and misses 32 cells at a time */
+void PackBoard(const Board *grid, PackedBoard *p) {
+    /* Low bit: ship not hit, or miss. High bit: shot at. */
+    Bitboard low = BitboardOr(BitboardAndNot(grid->ships, grid->hits), grid->misses);
+    Bitboard high = BitboardOr(grid->hits, grid->misses);
+    for (int k = 0; k * 32 < GRID_CELLS; ++k) {
+        uint64_t w = SpreadBits(BitboardWord32(low, k)) | (SpreadBits(BitboardWord32(high, k)) << 1);
+        for (int i = 0; i < 8 && k * 8 + i < PACKED_BYTES; ++i) p->cells[k * 8 + i] = (uint8_t)(w >> (8 * i));
+    }
+}
+
+/* The hit and missed cells of a packed board */
+void PackedShots(const PackedBoard *p, Bitboard *hits, Bitboard *misses) {
+    Bitboard low = { 0, 0 }, high = { 0, 0 };
+    for (int k = 0; k * 32 < GRID_CELLS; ++k) {
+        uint64_t w = 0;
+        for (int i = 0; i < 8 && k * 8 + i < PACKED_BYTES; ++i) w |= (uint64_t)p->cells[k * 8 + i] << (8 * i);
+        uint64_t lo = GatherBits(w), hi = GatherBits(w >> 1);
+        int shift = 32 * (k & 1);
+        if (k < 2) { low.lo |= lo << shift; high.lo |= hi << shift; }
+        else       { low.hi |= lo << shift; high.hi |= hi << shift; }
+    }
+    *hits = BitboardAndNot(high, low);
+    *misses = BitboardAnd(high, low);
+}
+
+/* Pack both sides of a game; side[i].playerShips holds side i's fleet.
+   A ship that is not placed is stored as PACKED_NO_SHIP. */
+void PackGame(const GameState side[2], PackedGame *out) {
+    for (int i = 0; i < 2; ++i) {
+        const Board *grid = &side[i].playerShips;
+        PackBoard(grid, &out->board[i]);
+        for (int s = 0; s < NUM_SHIPS; ++s) {
+            Bitboard cells = grid->fleet[s];
+            if (!BitboardAny(cells)) {
+                out->fleet[i][s] = PACKED_NO_SHIP;
+                continue;
+            }
+            int first = BitboardPopLowest(&cells);
+            int vertical = ships[s].size > 1 && BitboardTest(grid->fleet[s], first + GRID_SIZE);
+            out->fleet[i][s] = (uint8_t)(first * 2 + vertical);
+        }
+    }
+}
+
+/* Rebuild both sides: fleets, the shots each has taken and what each
+   shooter knows about the other */
+void UnpackGame(const PackedGame *in, GameState side[2]) {
+    memset(side, 0, 2 * sizeof(GameState));
+    for (int i = 0; i < 2; ++i) {
+        Board *grid = &side[i].playerShips;
+        for (int s = 0; s < NUM_SHIPS; ++s) {
+            if (in->fleet[i][s] == PACKED_NO_SHIP) continue;
+            int first = in->fleet[i][s] >> 1;
+            BoardAddShip(grid, s, ShipMask(first / GRID_SIZE, first % GRID_SIZE, ships[s].size,
+                                           in->fleet[i][s] & 1));
+        }
+        PackedShots(&in->board[i], &grid->hits, &grid->misses);
+        Board *known = &side[1 - i].playerShots;
+        for (int s = 0; s < NUM_SHIPS; ++s) {
+            if (!BitboardAny(grid->fleet[s])) continue;
+            grid->hitsLeft[s] = (uint8_t)BitboardCount(BitboardAndNot(grid->fleet[s], grid->hits));
+            if (grid->hitsLeft[s]) continue;
+            grid->sunk = BitboardOr(grid->sunk, grid->fleet[s]);
+            grid->afloat &= (uint8_t)~(1u << s);
+            grid->shipsLeft--;
+            known->fleet[s] = grid->fleet[s]; /* as RecordSunk marks it */
+        }
+        grid->key = BoardKey(grid);
+        known->hits = grid->hits;
+        known->misses = grid->misses;
+        known->sunk = grid->sunk;
+        known->key = BoardKey(known);
+    }
+}
+
+/* Pack and unpack both sides and check that each fleet's board comes back
+   the same. Returns 1 if it does. */
+int PackedRoundTripOk(const GameState side[2]) {
+    PackedGame packed;
+    GameState back[2];
+    PackGame(side, &packed);
+    UnpackGame(&packed, back);
+    for (int i = 0; i < 2; ++i) {
+        const Board *a = &side[i].playerShips, *b = &back[i].playerShips;
+        if (!BitboardEqual(a->ships, b->ships) || !BitboardEqual(a->hits, b->hits) ||
+            !BitboardEqual(a->misses, b->misses) || !BitboardEqual(a->sunk, b->sunk) ||
+            a->afloat != b->afloat || a->shipsLeft != b->shipsLeft || a->key != b->key ||
+            memcmp(a->hitsLeft, b->hitsLeft, sizeof(a->hitsLeft)) != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Object pool */
+
+/*
+ * Fixed-size slots carved out of large chunks. A released slot goes on a
+ * free list and is handed out again by the next acquire, so once a pool
+ * has grown to its working size, acquiring and releasing does no heap
+ * calls. A pool belongs to one thread; nothing here locks.
+ */
+
+#define POOL_ALIGN 64
+
+typedef struct PoolChunk {
+    struct PoolChunk *next;
+} PoolChunk;
+
+typedef struct {
+    size_t slotSize;    /* rounded up to POOL_ALIGN */
+    size_t chunkSlots;  /* slots added each time the pool grows */
+    void *freeList;     /* a free slot's first word points to the next one */
+    PoolChunk *chunks;
+    size_t inUse;
+    size_t capacity;
+} Pool;
+
+void PoolInit(Pool *pool, size_t slotSize, size_t chunkSlots) {
+    memset(pool, 0, sizeof(*pool));
+    pool->slotSize = (slotSize + POOL_ALIGN - 1) & ~(size_t)(POOL_ALIGN - 1);
+    pool->chunkSlots = chunkSlots ? chunkSlots : 1;
+}
+
+/* Add one chunk of slots to the free list. Returns -1 if out of memory. */
+static int PoolGrow(Pool *pool) {
+    size_t header = (sizeof(PoolChunk) + POOL_ALIGN - 1) & ~(size_t)(POOL_ALIGN - 1);
+    char *mem = aligned_alloc(POOL_ALIGN, header + pool->slotSize * pool->chunkSlots);
+    if (!mem) return -1;
+    allocCount++;
+    PoolChunk *chunk = (PoolChunk *)mem;
+    chunk->next = pool->chunks;
+    pool->chunks = chunk;
+    for (size_t i = pool->chunkSlots; i-- > 0;) {
+        void *slot = mem + header + i * pool->slotSize;
+        *(void **)slot = pool->freeList;
+        pool->freeList = slot;
+    }
+    pool->capacity += pool->chunkSlots;
+    return 0;
+}
+
+/* Take a zeroed slot. Returns NULL if out of memory. */
+void *PoolAcquire(Pool *pool) {
+    if (!pool->freeList && PoolGrow(pool) < 0) return NULL;
+    void *slot = pool->freeList;
+    pool->freeList = *(void **)slot;
+    pool->inUse++;
+    memset(slot, 0, pool->slotSize);
+    return slot;
+}
+
+/* Give a slot back for reuse */
+void PoolRelease(Pool *pool, void *slot) {
+    if (!slot) return;
+    *(void **)slot = pool->freeList;
+    pool->freeList = slot;
+    pool->inUse--;
+}
+
+/* Free every chunk; all slots become invalid */
+void PoolDestroy(Pool *pool) {
+    while (pool->chunks) {
+        PoolChunk *next = pool->chunks->next;
+        free(pool->chunks);
+        freeCount++;
+        pool->chunks = next;
+    }
+    pool->freeList = NULL;
+    pool->inUse = pool->capacity = 0;
+}
+
+/* Single-player helper functions */
+
+/* Return 1 if every ship on this grid has been sunk, else 0 */
+int GridAllShipsDestroyed(const Board *grid) {
+    return grid->shipsLeft == 0;
+}
+
+/* Mark a shot on the grid and say what it did: 0 for a miss, else
+   RESULT_HIT, plus RESULT_SUNK and the ship's index if that was its last
+   cell, plus RESULT_WIN if it was the last ship. Only the shot cell and
+   its ship's counters (and the board's Zobrist key) are touched.
+   Shooting a cell that was already hit counts as a miss but keeps the HIT. */
+int ApplyShotToGrid(Board *grid, int row, int col) {
+    int idx = CellIndex(row, col);
+    if (BitboardTest(grid->hits, idx)) return 0;
+    int owner = grid->shipAt[idx];
+    if (!owner) {
+        if (!BitboardTest(grid->misses, idx)) grid->key ^= ZobristKey(ZOBRIST_MISS, idx);
+        BitboardSet(&grid->misses, idx);
+        return 0;
+    }
+    BitboardSet(&grid->hits, idx);
+    grid->key ^= ZobristKey(ZOBRIST_HIT, idx);
+    int s = owner - 1;
+    if (--grid->hitsLeft[s] > 0) return RESULT_HIT;
+
+    grid->sunk = BitboardOr(grid->sunk, grid->fleet[s]);
+    grid->afloat &= (uint8_t)~(1u << s);
+    grid->key ^= ZobristKey(ZOBRIST_SUNK_SHIP, s);
+    for (Bitboard cells = grid->fleet[s]; BitboardAny(cells); ) {
+        grid->key ^= ZobristKey(ZOBRIST_SUNK_CELL, BitboardPopLowest(&cells));
+    }
+    int result = RESULT_HIT | RESULT_SUNK | (s << RESULT_SHIP_SHIFT);
+    if (--grid->shipsLeft == 0) result |= RESULT_WIN;
+    return result;
+}
+
+/* Mark ships[s] as sunk on a board that records our shots, once a RESULT
+   said the shot at (row, col) sank it. Such a board has no fleet, so the
+   ship's cells are taken to be the open hits in a line through the shot;
+   if several lines fit, only the cells they share are marked. fleet[s]
+   then holds those cells, which is how ComputerPickShot and BoardKey
+   tell that the ship is gone. Call it after RecordShot for the shot. */
+void RecordSunk(Board *grid, int s, int row, int col) {
+    int idx = CellIndex(row, col);
+    Bitboard open = BitboardAndNot(grid->hits, grid->sunk);
+    if (BitboardAny(grid->fleet[s]) || !BitboardTest(open, idx)) return;
+    InitPlacements();
+    Bitboard cells = { ~0ULL, ~0ULL };
+    int lines = 0;
+    const Bitboard *p = placements[ships[s].size];
+    for (int k = 0; k < placementCount[ships[s].size]; ++k) {
+        if (!BitboardTest(p[k], idx) || BitboardAny(BitboardAndNot(p[k], open))) continue;
+        cells = BitboardAnd(cells, p[k]);
+        lines++;
+    }
+    if (lines == 0) {
+        cells = (Bitboard){ 0, 0 };
+        BitboardSet(&cells, idx);
+    }
+
+    grid->fleet[s] = cells;
+    grid->sunk = BitboardOr(grid->sunk, cells);
+    grid->key ^= ZobristKey(ZOBRIST_SUNK_SHIP, s);
+    while (BitboardAny(cells)) grid->key ^= ZobristKey(ZOBRIST_SUNK_CELL, BitboardPopLowest(&cells));
+}
+
+/* Transposition table */
+
+/*
+ * Games keep reaching the same knowledge (the empty board every game, the
+ * first few shots very often), and the computer's density and exact
+ * shots depend on nothing else. The table keeps the per-cell scores
+ * computed for a Board key, so any thread can reuse them.
+ *
+ * It has a fixed number of entries, and a key goes to entry key & mask,
+ * replacing whatever was there. Nothing locks. Each entry has a sequence
+ * number that a writer makes odd while it fills the entry and even when
+ * it is done. A writer that finds it odd skips its store; a reader that
+ * finds it odd, or changed once the entry is copied, takes it as a miss.
+ */
+
+typedef enum { TT_HEAT, TT_EXACT } TTKind;
+
+typedef struct {
+    _Atomic uint64_t seq;      /* odd while being written */
+    _Atomic uint64_t key;      /* Board key ^ kind key; 0 = empty */
+    _Atomic uint64_t meta;     /* for TT_EXACT: 1 counted, 0 too many layouts */
+    _Atomic uint64_t cells[GRID_CELLS / 2];  /* a uint32_t score per cell */
+} TTEntry;
+
+typedef struct {
+    TTEntry *entries;          /* NULL: no table */
+    size_t mask;
+} TransTable;
+
+/* Set up by --tt-mb; shared by every thread */
+static TransTable transTable;
+
+/* What one thread did with the table, for sizing it */
+typedef struct {
+    unsigned long probes;
+    unsigned long hits;
+    unsigned long stores;
+    unsigned long replaced;    /* stores over another key */
+    unsigned long busy;        /* probes or stores that met a writer */
+} TTStats;
+
+static _Thread_local TTStats ttStats;
+
+/* Make a table of about megabytes MB (a power of two entries) */
+int TTInit(size_t megabytes) {
+    size_t n = 1;
+    while (2 * n * sizeof(TTEntry) <= megabytes << 20) n *= 2;
+    TTEntry *entries = calloc(n, sizeof(TTEntry));
+    if (!entries) { perror("calloc"); return -1; }
+    transTable.entries = entries;
+    transTable.mask = n - 1;
+    return 0;
+}
+
+static inline uint64_t TTKey(const Board *known, TTKind kind) {
+    return known->key ^ ZobristKey(ZOBRIST_KIND, (int)kind);
+}
+
+/* The key covers what known shows, so scores can be cached only when
+   they are computed from known's own sunk ships */
+static inline int TTUsable(const Board *known, Bitboard sunk) {
+    return transTable.entries && sunk.lo == known->sunk.lo && sunk.hi == known->sunk.hi;
+}
+
+/* Copy out the scores stored for key; 0 if they are not there */
+int TTProbe(uint64_t key, uint32_t cells[GRID_CELLS], uint64_t *meta) {
+    TTEntry *e = &transTable.entries[key & transTable.mask];
+    ttStats.probes++;
+    uint64_t seq = atomic_load_explicit(&e->seq, memory_order_acquire);
+    if (seq & 1) { ttStats.busy++; return 0; }
+    if (atomic_load_explicit(&e->key, memory_order_relaxed) != key) return 0;
+    *meta = atomic_load_explicit(&e->meta, memory_order_relaxed);
+    for (int i = 0; i < GRID_CELLS / 2; ++i) {
+        uint64_t w = atomic_load_explicit(&e->cells[i], memory_order_relaxed);
+        cells[2 * i] = (uint32_t)w;
+        cells[2 * i + 1] = (uint32_t)(w >> 32);
+    }
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&e->seq, memory_order_relaxed) != seq) { ttStats.busy++; return 0; }
+    ttStats.hits++;
+    return 1;
+}
+
+/* Store scores for key unless another thread is writing that entry */
+void TTStore(uint64_t key, const uint32_t cells[GRID_CELLS], uint64_t meta) {
+    TTEntry *e = &transTable.entries[key & transTable.mask];
+    uint64_t seq = atomic_load_explicit(&e->seq, memory_order_relaxed);
+    if ((seq & 1) || !atomic_compare_exchange_strong_explicit(&e->seq, &seq, seq + 1,
+                                                              memory_order_relaxed, memory_order_relaxed)) {
+        ttStats.busy++;
+        return;
+    }
+    atomic_thread_fence(memory_order_release);
+    uint64_t old = atomic_load_explicit(&e->key, memory_order_relaxed);
+    if (old && old != key) ttStats.replaced++;
+    atomic_store_explicit(&e->key, key, memory_order_relaxed);
+    atomic_store_explicit(&e->meta, meta, memory_order_relaxed);
+    for (int i = 0; i < GRID_CELLS / 2; ++i) {
+        atomic_store_explicit(&e->cells[i], cells[2 * i] | (uint64_t)cells[2 * i + 1] << 32, memory_order_relaxed);
+    }
+    atomic_store_explicit(&e->seq, seq + 2, memory_order_release);
+    ttStats.stores++;
+}
+
+void TTStatsMerge(TTStats *into, const TTStats *from) {
+    into->probes += from->probes;
+    into->hits += from->hits;
+    into->stores += from->stores;
+    into->replaced += from->replaced;
+    into->busy += from->busy;
+}
+
+void TTStatsPrint(const TTStats *t) {
+    printf("tt entries:       %zu (%.1f MB)\n", transTable.mask + 1,
+           (double)((transTable.mask + 1) * sizeof(TTEntry)) / (1 << 20));
+    printf("tt probes:        %lu, %.2f%% hits\n", t->probes,
+           t->probes ? 100.0 * (double)t->hits / (double)t->probes : 0.0);
+    printf("tt stores:        %lu (%lu replaced another key, %lu busy)\n", t->stores, t->replaced, t->busy);
+}
+
+/* Computer targeting */
+
+/*
+ * To pick a shot the computer counts, for each open cell, how many placements
+ * of the ships still afloat cross it without touching a miss. Placements
+ * that run through hits of unsunk ships count TARGET_WEIGHT times more per
+ * hit, so the computer finishes off a ship once it has found it. The cell
+ * with the highest count is the most likely to hold a ship.
+ */
+
+#define TARGET_WEIGHT 40
+
+typedef enum { AI_DENSITY, AI_RANDOM, AI_EXACT } ComputerStrategy;
+
+/* How the computer picks its shots; --ai random brings back the old way,
+   --ai exact counts whole fleets (see "Exact posterior") */
+static ComputerStrategy computerStrategy = AI_DENSITY;
+
+/* --ai NAME: density (the default), random or exact */
+static ComputerStrategy ParseStrategy(const char *name) {
+    if (strcmp(name, "random") == 0) return AI_RANDOM;
+    if (strcmp(name, "exact") == 0)  return AI_EXACT;
+    return AI_DENSITY;
+}
+
+static const char *StrategyName(ComputerStrategy strategy) {
+    return strategy == AI_RANDOM ? "random" : strategy == AI_EXACT ? "exact" : "density";
+}
+
+/* Fill heat[] with placement counts for every cell.
+   known:  hits and misses seen so far
+   sunk:   cells of ships known to be sunk (their hits are settled)
+   afloat: bit s set if ships[s] may still be afloat */
+void ComputeHeatMap(const Board *known, Bitboard sunk, unsigned afloat, uint32_t heat[GRID_CELLS]) {
+    InitPlacements();
+    memset(heat, 0, GRID_CELLS * sizeof(heat[0]));
+    Bitboard shot = BitboardOr(known->hits, known->misses);
+    Bitboard blocked = BitboardOr(known->misses, sunk);
+    Bitboard open = BitboardAndNot(known->hits, sunk);
+
+    for (int s = 0; s < NUM_SHIPS; ++s) {
+        if (!(afloat & (1u << s))) continue;
+        int size = ships[s].size;
+        const Bitboard *p = placements[size];
+        for (int i = 0; i < placementCount[size]; ++i) {
+            if (BitboardAny(BitboardAnd(p[i], blocked))) continue;
+            uint32_t weight = 1 + (uint32_t)BitboardCount(BitboardAnd(p[i], open)) * TARGET_WEIGHT;
+            Bitboard cells = BitboardAndNot(p[i], shot);
+            while (BitboardAny(cells)) heat[BitboardPopLowest(&cells)] += weight;
+        }
+    }
+}
+
+/* Pick a random cell that has not been shot. No retry loop: draw a
+   number below the count of open cells and walk to that open cell. */
+int PickRandomOpenCell(const Board *known, Rng *rng) {
+    Bitboard open = BitboardAndNot(BitboardFromMask(GRID_CELLS), BitboardOr(known->hits, known->misses));
+    int k = RngBelow(rng, BitboardCount(open));
+    while (k-- > 0) BitboardPopLowest(&open);
+    return BitboardPopLowest(&open);
+}
+
+/* Cell with the highest heat; ties are broken at random */
+int ChooseDensityShot(const Board *known, Bitboard sunk, unsigned afloat, Rng *rng) {
+    uint32_t heat[GRID_CELLS];
+    uint64_t meta;
+    int cached = TTUsable(known, sunk);
+    uint64_t key = TTKey(known, TT_HEAT);
+    if (!cached || !TTProbe(key, heat, &meta)) {
+        ComputeHeatMap(known, sunk, afloat, heat);
+        if (cached) TTStore(key, heat, 0);
+    }
+    int best = -1;
+    uint32_t bestHeat = 0;
+    int ties = 0;
+    for (int i = 0; i < GRID_CELLS; ++i) {
+        if (heat[i] > bestHeat) {
+            best = i;
+            bestHeat = heat[i];
+            ties = 1;
+        } else if (heat[i] == bestHeat && bestHeat > 0 && RngBelow(rng, ++ties) == 0) {
+            best = i;
+        }
+    }
+    /* No placement fits what we saw (should not happen): shoot anywhere */
+    if (best < 0) best = PickRandomOpenCell(known, rng);
+    return best;
+}
+
+/* Exact posterior */
+
+/*
+ * ComputeHeatMap weighs the placements of single ships. This engine
+ * counts whole fleets instead: every way to put all ships still afloat on
+ * the board at once, off misses and sunk ships, without overlaps,
+ * covering every open hit and with no ship lying wholly on hits (it would
+ * have sunk). The share of those layouts that put a ship on a cell is the
+ * exact chance that the cell holds one, given a uniformly drawn fleet.
+ *
+ * An open hit is under exactly one ship. While more than three ships
+ * are left and a hit is open, the count is split by the ship and
+ * placement over the lowest one, and each part counts the other ships
+ * with those cells blocked and one ship fewer.
+ *
+ * Ships are placed largest first, one level per ship, down to the last
+ * three. A state at a level is what the ships still to place can see:
+ * the cells they could use that are already taken. Cells none of their
+ * placements reach are dropped, and every state is kept once with the
+ * number of ways it was reached, so all the layouts of the first ships
+ * that leave the same board to the rest are counted from there once.
+ *
+ * The last three ships are not enumerated. Two straight ships share a
+ * cell exactly when the cells they share, less the pairs of neighbouring
+ * cells they share, come to one; three that cross pairwise always share
+ * a cell. So with the number of free placements over every cell and over
+ * every pair of neighbours, inclusion-exclusion over the three overlaps
+ * gives the layouts of the last three, and the layouts through each of
+ * their placements, in a few passes over the placements. Hits they
+ * still have to cover split their count the same way as above.
+ * That level is split over threads. A backward pass then gives every
+ * earlier placement the number of layouts that use it, and the cells add
+ * those up.
+ */
+
+#define EXACT_MAX_STATES_AI (1 << 12) /* per level before ExactShot gives up */
+#define EXACT_TAIL 3                  /* ships counted in closed form */
+
+/* A set of occupied cells reached at one level */
+typedef struct {
+    Bitboard occ;     /* cells taken by the ships placed so far, that the rest could use */
+    uint64_t reach;   /* ways to get here; 0 marks a free slot */
+    uint64_t finish;  /* ways to place the remaining ships from here */
+} ExactState;
+
+typedef struct {
+    ExactState *slots;
+    size_t mask;      /* slots - 1, slots is a power of two */
+    size_t count;
+} ExactLevel;
+
+typedef struct {
+    uint64_t layouts;              /* fleets that fit what was seen */
+    uint64_t cover[GRID_CELLS];    /* of those, how many put a ship on each cell */
+    long states;                   /* distinct states kept over all levels */
+} Posterior;
+
+/* One counting job */
+typedef struct {
+    Bitboard blocked;                  /* misses and sunk ships */
+    Bitboard open;                     /* hits not on sunk ships */
+    int n;                             /* ships afloat */
+    int tail;                          /* the first of the last ships */
+    int size[NUM_SHIPS];               /* their sizes, largest first */
+    int rest[NUM_SHIPS + 1];           /* cells of ships i.. */
+    Bitboard reach[NUM_SHIPS + 1];     /* cells the placements of ships i.. can use */
+    uint16_t fits[NUM_SHIPS][MAX_PLACEMENTS]; /* placements clear of blocked */
+    int fitCount[NUM_SHIPS];
+    uint8_t fit[NUM_SHIPS][MAX_PLACEMENTS];   /* the same as flags */
+    uint64_t weight[NUM_SHIPS][MAX_PLACEMENTS]; /* layouts using each placement */
+    ExactLevel level[NUM_SHIPS];
+    size_t maxStates;
+} ExactSearch;
+
+/* placeFirst[size][i] and placeDown[size][i]: the first cell of
+   placement i of that size, and whether it runs down */
+static uint8_t placeFirst[GRID_SIZE + 1][MAX_PLACEMENTS];
+static uint8_t placeDown[GRID_SIZE + 1][MAX_PLACEMENTS];
+/* placeOver[size][cell]: the placements of that size over the cell */
+static uint16_t placeOver[GRID_SIZE + 1][GRID_CELLS][2 * GRID_SIZE];
+static uint8_t placeOverCount[GRID_SIZE + 1][GRID_CELLS];
+static pthread_once_t exactOnce = PTHREAD_ONCE_INIT;
+
+static void BuildExactTables(void) {
+    InitPlacements();
+    for (int size = 1; size <= GRID_SIZE; ++size) {
+        for (int i = 0; i < placementCount[size]; ++i) {
+            Bitboard cells = placements[size][i];
+            int first = BitboardPopLowest(&cells);
+            placeFirst[size][i] = (uint8_t)first;
+            placeDown[size][i] = size > 1 && BitboardTest(placements[size][i], first + GRID_SIZE);
+            cells = placements[size][i];
+            while (BitboardAny(cells)) {
+                int cell = BitboardPopLowest(&cells);
+                placeOver[size][cell][placeOverCount[size][cell]++] = (uint16_t)i;
+            }
+        }
+    }
+}
+
+static inline size_t ExactHash(Bitboard occ) {
+    uint64_t h = occ.lo * 0x9E3779B97F4A7C15ULL ^ occ.hi * 0xC2B2AE3D27D4EB4FULL;
+    return (size_t)(h ^ (h >> 29));
+}
+
+static void ExactLevelInit(ExactLevel *l, size_t slots) {
+    l->slots = calloc(slots, sizeof(ExactState));
+    if (!l->slots) { perror("calloc"); exit(EXIT_FAILURE); }
+    l->mask = slots - 1;
+    l->count = 0;
+}
+
+static void ExactLevelFree(ExactLevel *l) {
+    free(l->slots);
+    memset(l, 0, sizeof(*l));
+}
+
+static ExactState *ExactLevelFind(const ExactLevel *l, Bitboard occ) {
+    for (size_t i = ExactHash(occ) & l->mask; l->slots[i].reach; i = (i + 1) & l->mask) {
+        if (l->slots[i].occ.lo == occ.lo && l->slots[i].occ.hi == occ.hi) return &l->slots[i];
+    }
+    return NULL;
+}
+
+/* Add reach ways to get to occ; -1 if the level would pass maxStates */
+static int ExactLevelAdd(ExactLevel *l, Bitboard occ, uint64_t reach, size_t maxStates) {
+    size_t i = ExactHash(occ) & l->mask;
+    for (; l->slots[i].reach; i = (i + 1) & l->mask) {
+        if (l->slots[i].occ.lo == occ.lo && l->slots[i].occ.hi == occ.hi) {
+            l->slots[i].reach += reach;
+            return 0;
+        }
+    }
+    if (l->count == maxStates) return -1;
+    l->slots[i].occ = occ;
+    l->slots[i].reach = reach;
+    l->count++;
+    if (2 * l->count > l->mask + 1) {
+        ExactLevel bigger;
+        ExactLevelInit(&bigger, 2 * (l->mask + 1));
+        for (size_t j = 0; j <= l->mask; ++j) {
+            const ExactState *s = &l->slots[j];
+            if (!s->reach) continue;
+            size_t k = ExactHash(s->occ) & bigger.mask;
+            while (bigger.slots[k].reach) k = (k + 1) & bigger.mask;
+            bigger.slots[k] = *s;
+        }
+        bigger.count = l->count;
+        ExactLevelFree(l);
+        *l = bigger;
+    }
+    return 0;
+}
+
+/* The state at level lv after placing q on occ, in *next; 0 if no
+   layout can go on from there. Hits the ships before lv could not reach
+   were covered on the way here. */
+static inline int ExactChild(const ExactSearch *x, int lv, Bitboard occ, Bitboard q, Bitboard *next) {
+    Bitboard taken = BitboardOr(occ, q);
+    Bitboard seen = lv > 0 ? x->reach[lv - 1] : BitboardFromMask(GRID_CELLS);
+    Bitboard need = BitboardAndNot(BitboardAnd(x->open, seen), taken);
+    if (BitboardAny(BitboardAndNot(need, x->reach[lv]))) return 0;
+    if (BitboardCount(need) > x->rest[lv]) return 0;
+    *next = BitboardAnd(taken, x->reach[lv]);
+    return 1;
+}
+
+/* The free placements of one of the last ships: how many lie over each
+   cell, and over each cell together with its neighbour right ([0]) or
+   below ([1]) */
+typedef struct {
+    int size;
+    int count;
+    uint16_t place[MAX_PLACEMENTS];
+    int32_t cell[GRID_CELLS];
+    int32_t edge[2][GRID_CELLS];
+} TailSet;
+
+/* Weighted the same way: each placement counts as w[placement] */
+typedef struct {
+    int32_t cell[GRID_CELLS];
+    int32_t edge[2][GRID_CELLS];
+} TailSum;
+
+/* t = all less the placements over taken */
+static void TailSetBuild(TailSet *t, const TailSet *all, const uint8_t *fit, Bitboard taken,
+                         uint32_t *mark, uint32_t stamp) {
+    int size = all->size;
+    t->size = size;
+    memcpy(t->cell, all->cell, sizeof(t->cell));
+    memcpy(t->edge, all->edge, sizeof(t->edge));
+    while (BitboardAny(taken)) {
+        int cell = BitboardPopLowest(&taken);
+        for (int k = 0; k < placeOverCount[size][cell]; ++k) {
+            int i = placeOver[size][cell][k];
+            if (!fit[i] || mark[i] == stamp) continue;
+            mark[i] = stamp;
+            int first = placeFirst[size][i], down = placeDown[size][i], step = down ? GRID_SIZE : 1;
+            for (int c = 0; c < size; ++c) t->cell[first + c * step]--;
+            for (int c = 0; c + 1 < size; ++c) t->edge[down][first + c * step]--;
+        }
+    }
+    t->count = 0;
+    for (int k = 0; k < all->count; ++k) {
+        if (mark[all->place[k]] != stamp) t->place[t->count++] = all->place[k];
+    }
+}
+
+/* All the fitting placements of ship */
+static void TailSetFull(TailSet *t, const ExactSearch *x, int ship) {
+    int size = x->size[ship];
+    memset(t, 0, sizeof(*t));
+    t->size = size;
+    for (int k = 0; k < x->fitCount[ship]; ++k) {
+        int i = x->fits[ship][k];
+        t->place[t->count++] = (uint16_t)i;
+        int first = placeFirst[size][i], down = placeDown[size][i], step = down ? GRID_SIZE : 1;
+        for (int c = 0; c < size; ++c) t->cell[first + c * step]++;
+        for (int c = 0; c + 1 < size; ++c) t->edge[down][first + c * step]++;
+    }
+}
+
+static void TailSumBuild(TailSum *s, const TailSet *t, const int32_t *w) {
+    memset(s, 0, sizeof(*s));
+    for (int k = 0; k < t->count; ++k) {
+        int i = t->place[k];
+        int first = placeFirst[t->size][i], down = placeDown[t->size][i], step = down ? GRID_SIZE : 1;
+        for (int c = 0; c < t->size; ++c) s->cell[first + c * step] += w[k];
+        for (int c = 0; c + 1 < t->size; ++c) s->edge[down][first + c * step] += w[k];
+    }
+}
+
+/* Placements of t that cross placement i of a ship of size */
+static inline int32_t TailCrossing(const TailSet *t, int size, int i) {
+    int first = placeFirst[size][i], down = placeDown[size][i], step = down ? GRID_SIZE : 1;
+    int32_t n = 0;
+    for (int c = 0; c < size; ++c) n += t->cell[first + c * step];
+    for (int c = 0; c + 1 < size; ++c) n -= t->edge[down][first + c * step];
+    return n;
+}
+
+/* Overlapping pairs of a and b (weighted by s) that both cross
+   placement i of a ship of size */
+static inline int32_t TailSumCrossing(const TailSum *s, int size, int i) {
+    int first = placeFirst[size][i], down = placeDown[size][i], step = down ? GRID_SIZE : 1;
+    int32_t n = 0;
+    for (int c = 0; c < size; ++c) n += s->cell[first + c * step];
+    for (int c = 0; c + 1 < size; ++c) n -= s->edge[down][first + c * step];
+    return n;
+}
+
+/* Pairs of a placement from a and one from b that overlap and both
+   cross placement i of a ship of size */
+static inline int32_t TailBothCrossing(const TailSet *a, const TailSet *b, int size, int i) {
+    int first = placeFirst[size][i], down = placeDown[size][i], step = down ? GRID_SIZE : 1;
+    int32_t n = 0;
+    for (int c = 0; c < size; ++c) {
+        int cell = first + c * step;
+        n += a->cell[cell] * b->cell[cell];
+    }
+    for (int c = 0; c + 1 < size; ++c) {
+        int cell = first + c * step;
+        n -= a->edge[down][cell] * b->edge[down][cell];
+    }
+    return n;
+}
+
+/* Slice of the tail level for one thread */
+typedef struct {
+    ExactSearch *search;
+    size_t from, to;                              /* slots of the tail level */
+    uint64_t weight[EXACT_TAIL][MAX_PLACEMENTS];  /* for the last ships */
+    TailSet all[EXACT_TAIL];                      /* every fitting placement of each */
+    uint32_t mark[MAX_PLACEMENTS], stamp;         /* placements TailSetBuild took off */
+    /* scratch for ExactTailClosed, by set: ships of one size share one */
+    TailSet set[EXACT_TAIL];
+    TailSum sum[EXACT_TAIL][EXACT_TAIL];          /* [a][b]: set a weighted by its crossings of b */
+    int32_t cross[EXACT_TAIL][EXACT_TAIL][MAX_PLACEMENTS]; /* [a][b][p]: placements of b that p of a crosses */
+    int64_t ways[EXACT_TAIL][MAX_PLACEMENTS];     /* [a][p]: layouts through p of a */
+} ExactTailJob;
+
+/* Layouts of the last ships in ship[0..m) (numbered from x->tail) clear
+   of taken, with no hits left to cover. Each placement of theirs gets
+   reach times the layouts through it. All sums are mod 2^64: the
+   inclusion-exclusion steps may go below zero on the way, the totals
+   come out right. */
+static uint64_t ExactTailClosed(ExactTailJob *job, const int *ship, int m, Bitboard taken, uint64_t reach) {
+    ExactSearch *x = job->search;
+    TailSet *set = job->set;
+    int kind[EXACT_TAIL], kinds = 0;
+    for (int j = 0; j < m; ++j) {
+        int k = 0;
+        while (k < j && x->size[x->tail + ship[k]] != x->size[x->tail + ship[j]]) ++k;
+        if (k < j) {
+            kind[j] = kind[k];
+        } else {
+            kind[j] = kinds++;
+            TailSetBuild(&set[kind[j]], &job->all[ship[j]], x->fit[x->tail + ship[j]], taken,
+                         job->mark, ++job->stamp);
+        }
+    }
+
+    /* placements of the set of k each placement of the set of j crosses */
+    int64_t n[EXACT_TAIL], cross[EXACT_TAIL][EXACT_TAIL];
+    int crossed[EXACT_TAIL][EXACT_TAIL] = { { 0 } };
+    for (int j = 0; j < m; ++j) n[j] = set[kind[j]].count;
+    for (int j = 0; j < m; ++j) {
+        for (int k = 0; k < m; ++k) {
+            int a = kind[j], b = kind[k];
+            if (k == j || crossed[a][b]) continue;
+            crossed[a][b] = 1;
+            cross[a][b] = 0;
+            for (int p = 0; p < set[a].count; ++p) {
+                job->cross[a][b][p] = TailCrossing(&set[b], set[a].size, set[a].place[p]);
+                cross[a][b] += job->cross[a][b][p];
+            }
+        }
+    }
+
+    int64_t layouts;
+    if (m == 0) {
+        layouts = 1;
+    } else if (m == 1) {
+        layouts = n[0];
+        for (int p = 0; p < set[0].count; ++p) job->ways[0][p] = 1;
+    } else if (m == 2) {
+        layouts = n[0] * n[1] - cross[kind[0]][kind[1]];
+        for (int j = 0; j < 2; ++j) {
+            int a = kind[j], b = kind[1 - j];
+            for (int p = 0; p < set[a].count; ++p) job->ways[a][p] = n[1 - j] - job->cross[a][b][p];
+        }
+    } else {
+        /* placements of j that cross both others, and the triples that
+           cross pairwise: those share a cell, and a run of cells when
+           all three lie along one line */
+        int64_t paths = 0, triangles = 0;
+        for (int j = 0; j < 3; ++j) {
+            int a = kind[j], b1 = kind[(j + 1) % 3], b2 = kind[(j + 2) % 3];
+            for (int p = 0; p < set[a].count; ++p) paths += (int64_t)job->cross[a][b1][p] * job->cross[a][b2][p];
+        }
+        const TailSet *s0 = &set[kind[0]], *s1 = &set[kind[1]], *s2 = &set[kind[2]];
+        for (int c = 0; c < GRID_CELLS; ++c) {
+            triangles += (int64_t)s0->cell[c] * s1->cell[c] * s2->cell[c];
+            for (int d = 0; d < 2; ++d) triangles -= (int64_t)s0->edge[d][c] * s1->edge[d][c] * s2->edge[d][c];
+        }
+        layouts = n[0] * n[1] * n[2] - cross[kind[0]][kind[1]] * n[2] - cross[kind[0]][kind[2]] * n[1]
+                - cross[kind[1]][kind[2]] * n[0] + paths - triangles;
+
+        int summed[EXACT_TAIL][EXACT_TAIL] = { { 0 } };
+        for (int j = 0; j < 3; ++j) {
+            for (int k = 0; k < 3; ++k) {
+                int a = kind[j], b = kind[k];
+                if (k == j || summed[a][b]) continue;
+                summed[a][b] = 1;
+                TailSumBuild(&job->sum[a][b], &set[a], job->cross[a][b]);
+            }
+        }
+        /* p of j leaves the pairs of the other two that fit together
+           and miss p; ships of one size get the same */
+        for (int j = 0; j < 3; ++j) {
+            int a = kind[j], k1 = kind[(j + 1) % 3], k2 = kind[(j + 2) % 3];
+            if (j > 0 && (a == kind[0] || (j > 1 && a == kind[1]))) continue;
+            int64_t n1 = n[(j + 1) % 3], n2 = n[(j + 2) % 3];
+            for (int p = 0; p < set[a].count; ++p) {
+                int i = set[a].place[p];
+                int64_t overlapping = cross[k1][k2]
+                    - TailSumCrossing(&job->sum[k1][k2], set[a].size, i)
+                    - TailSumCrossing(&job->sum[k2][k1], set[a].size, i)
+                    + TailBothCrossing(&set[k1], &set[k2], set[a].size, i);
+                job->ways[a][p] = (n1 - job->cross[a][k1][p]) * (n2 - job->cross[a][k2][p]) - overlapping;
+            }
+        }
+    }
+    for (int j = 0; j < m; ++j) {
+        const TailSet *t = &set[kind[j]];
+        uint64_t *w = job->weight[ship[j]];
+        for (int p = 0; p < t->count; ++p) w[t->place[p]] += reach * (uint64_t)job->ways[kind[j]][p];
+    }
+    return (uint64_t)layouts;
+}
+
+/* Layouts of the last ships in ship[0..m) clear of taken that cover
+   every cell of need. The lowest cell of need is under exactly one of
+   them, so the count is split by which ship and placement covers it. */
+static uint64_t ExactTailCount(ExactTailJob *job, const int *ship, int m, Bitboard taken, Bitboard need,
+                               uint64_t reach) {
+    ExactSearch *x = job->search;
+    int cells = 0, needCount = BitboardCount(need);
+    for (int j = 0; j < m; ++j) cells += x->size[x->tail + ship[j]];
+    if (needCount > cells) return 0;
+    if (needCount == 0) return ExactTailClosed(job, ship, m, taken, reach);
+
+    Bitboard low = need;
+    int cell = BitboardPopLowest(&low);
+    uint64_t layouts = 0;
+    for (int j = 0; j < m; ++j) {
+        int s = x->tail + ship[j], size = x->size[s];
+        int others[EXACT_TAIL];
+        for (int k = 0, o = 0; k < m; ++k) if (k != j) others[o++] = ship[k];
+        for (int k = 0; k < placeOverCount[size][cell]; ++k) {
+            int i = placeOver[size][cell][k];
+            Bitboard q = placements[size][i];
+            if (!x->fit[s][i] || BitboardAny(BitboardAnd(q, taken))) continue;
+            uint64_t ways = ExactTailCount(job, others, m - 1, BitboardOr(taken, q), BitboardAndNot(need, q), reach);
+            job->weight[ship[j]][i] += reach * ways;
+            layouts += ways;
+        }
+    }
+    return layouts;
+}
+
+/* Count the ways to finish with the last ships from every state in the
+   slice, and how many of them use each placement of those ships */
+static void *ExactTailWorker(void *arg) {
+    ExactTailJob *job = arg;
+    ExactSearch *x = job->search;
+    ExactLevel *l = &x->level[x->tail];
+    int ship[EXACT_TAIL];
+    for (int j = 0; j < x->n - x->tail; ++j) {
+        ship[j] = j;
+        TailSetFull(&job->all[j], x, x->tail + j);
+    }
+    for (size_t slot = job->from; slot < job->to; ++slot) {
+        ExactState *st = &l->slots[slot];
+        if (!st->reach) continue;
+        Bitboard need = BitboardAndNot(BitboardAnd(x->open, x->reach[x->tail]), st->occ);
+        st->finish = ExactTailCount(job, ship, x->n - x->tail, st->occ, need, st->reach);
+    }
+    return NULL;
+}
+
+static int ExactCount(ExactSearch *x, int threads, uint64_t *layouts, long *states);
+
+/* The lowest open hit is under exactly one ship, so the layouts are
+   split by which ship and placement: each leaves the others to count
+   with its cells blocked and the hits under it covered */
+static int ExactSplit(ExactSearch *x, int threads, uint64_t *layouts, long *states) {
+    Bitboard low = x->open;
+    int cell = BitboardPopLowest(&low);
+    ExactSearch *y = malloc(sizeof(ExactSearch));
+    if (!y) { perror("malloc"); return -1; }
+    *layouts = 0;
+    for (int s = 0; s < x->n; ++s) {
+        int size = x->size[s];
+        if (s > 0 && size == x->size[s - 1]) continue; /* ships of one size leave the same */
+        for (int k = 0; k < placeOverCount[size][cell]; ++k) {
+            int i = placeOver[size][cell][k];
+            if (!x->fit[s][i]) continue;
+            memset(y, 0, sizeof(*y));
+            y->blocked = BitboardOr(x->blocked, placements[size][i]);
+            y->open = BitboardAndNot(x->open, placements[size][i]);
+            y->maxStates = x->maxStates;
+            y->n = x->n - 1;
+            for (int c = 0; c < y->n; ++c) y->size[c] = x->size[c < s ? c : c + 1];
+            uint64_t ways;
+            if (ExactCount(y, threads, &ways, states) < 0) { free(y); return -1; }
+            if (!ways) continue;
+            for (int t = s; t < x->n && x->size[t] == size; ++t) {
+                *layouts += ways;
+                x->weight[t][i] += ways;
+                for (int c = 0; c < y->n; ++c) {
+                    uint64_t *w = x->weight[c < t ? c : c + 1];
+                    for (int p = 0; p < y->fitCount[c]; ++p) w[y->fits[c][p]] += y->weight[c][y->fits[c][p]];
+                }
+            }
+        }
+    }
+    free(y);
+    return 0;
+}
+
+/* Count the layouts of the n ships of x (largest first) clear of
+   blocked, covering open, and the layouts through each placement in
+   x->weight. -1 if a level would pass maxStates. */
+static int ExactCount(ExactSearch *x, int threads, uint64_t *layouts, long *states) {
+    x->tail = x->n > EXACT_TAIL ? x->n - EXACT_TAIL : 0;
+    x->rest[x->n] = 0;
+    for (int i = x->n - 1; i >= 0; --i) x->rest[i] = x->rest[i + 1] + x->size[i];
+    for (int i = 0; i < x->n; ++i) {
+        const Bitboard *p = placements[x->size[i]];
+        for (int k = 0; k < placementCount[x->size[i]]; ++k) {
+            if (BitboardAny(BitboardAnd(p[k], x->blocked))) continue;
+            if (!BitboardAny(BitboardAndNot(p[k], x->open))) continue; /* would be sunk */
+            x->fits[i][x->fitCount[i]++] = (uint16_t)k;
+            x->fit[i][k] = 1;
+        }
+    }
+    *layouts = 0;
+    if (x->n == 0) {
+        *layouts = BitboardAny(x->open) ? 0 : 1;
+        return 0;
+    }
+    if (BitboardCount(x->open) > x->rest[0]) return 0;
+    if (BitboardAny(x->open) && x->n > EXACT_TAIL) return ExactSplit(x, threads, layouts, states);
+    for (int i = x->n - 1; i >= 0; --i) {
+        x->reach[i] = x->reach[i + 1];
+        for (int k = 0; k < x->fitCount[i]; ++k) x->reach[i] = BitboardOr(x->reach[i], placements[x->size[i]][x->fits[i][k]]);
+    }
+
+    int result = 0;
+    ExactLevelInit(&x->level[0], 16);
+    Bitboard start;
+    if (ExactChild(x, 0, (Bitboard){ 0, 0 }, (Bitboard){ 0, 0 }, &start)) {
+        ExactLevelAdd(&x->level[0], start, 1, x->maxStates);
+    }
+    /* forward: every distinct state the first ships can leave */
+    for (int lv = 0; lv < x->tail && result == 0; ++lv) {
+        ExactLevelInit(&x->level[lv + 1], 1024);
+        const Bitboard *p = placements[x->size[lv]];
+        ExactLevel *from = &x->level[lv];
+        for (size_t slot = 0; slot <= from->mask && result == 0; ++slot) {
+            const ExactState *st = &from->slots[slot];
+            if (!st->reach) continue;
+            for (int k = 0; k < x->fitCount[lv]; ++k) {
+                Bitboard q = p[x->fits[lv][k]], next;
+                if (BitboardAny(BitboardAnd(q, st->occ))) continue;
+                if (!ExactChild(x, lv + 1, st->occ, q, &next)) continue;
+                if (ExactLevelAdd(&x->level[lv + 1], next, st->reach, x->maxStates) < 0) { result = -1; break; }
+            }
+        }
+    }
+
+    if (result == 0) {
+        /* the last ships, in slices over threads */
+        ExactLevel *tl = &x->level[x->tail];
+        if (threads < 1) threads = 1;
+        if ((size_t)threads > tl->count / 64 + 1) threads = (int)(tl->count / 64 + 1);
+        ExactTailJob *jobs = calloc((size_t)threads, sizeof(ExactTailJob));
+        pthread_t *tids = calloc((size_t)threads, sizeof(pthread_t));
+        if (!jobs || !tids) { perror("calloc"); exit(EXIT_FAILURE); }
+        size_t slots = tl->mask + 1, step = (slots + (size_t)threads - 1) / (size_t)threads;
+        int started = 1; /* job 0 runs on this thread */
+        for (int t = 0; t < threads; ++t) {
+            jobs[t].search = x;
+            jobs[t].from = (size_t)t * step < slots ? (size_t)t * step : slots;
+            jobs[t].to = jobs[t].from + step < slots ? jobs[t].from + step : slots;
+        }
+        while (started < threads && pthread_create(&tids[started], NULL, ExactTailWorker, &jobs[started]) == 0) started++;
+        for (int t = started; t < threads; ++t) ExactTailWorker(&jobs[t]);
+        ExactTailWorker(&jobs[0]);
+        for (int t = 0; t < threads; ++t) {
+            if (t > 0 && t < started) pthread_join(tids[t], NULL);
+            for (int j = 0; j < x->n - x->tail; ++j) {
+                for (int i = 0; i < MAX_PLACEMENTS; ++i) x->weight[x->tail + j][i] += jobs[t].weight[j][i];
+            }
+        }
+        free(jobs);
+        free(tids);
+
+        /* backward: ways to finish from each earlier state, and the
+           layouts through each placement on the way */
+        for (int lv = x->tail - 1; lv >= 0; --lv) {
+            const Bitboard *p = placements[x->size[lv]];
+            ExactLevel *l = &x->level[lv];
+            for (size_t slot = 0; slot <= l->mask; ++slot) {
+                ExactState *st = &l->slots[slot];
+                if (!st->reach) continue;
+                for (int k = 0; k < x->fitCount[lv]; ++k) {
+                    int i = x->fits[lv][k];
+                    Bitboard next;
+                    if (BitboardAny(BitboardAnd(p[i], st->occ))) continue;
+                    if (!ExactChild(x, lv + 1, st->occ, p[i], &next)) continue;
+                    const ExactState *child = ExactLevelFind(&x->level[lv + 1], next);
+                    if (!child || !child->finish) continue;
+                    st->finish += child->finish;
+                    x->weight[lv][i] += st->reach * child->finish;
+                }
+            }
+        }
+        const ExactState *root = x->level[0].count ? ExactLevelFind(&x->level[0], start) : NULL;
+        *layouts = root ? root->finish : 0;
+    }
+    for (int lv = 0; lv <= x->tail; ++lv) {
+        *states += (long)x->level[lv].count;
+        ExactLevelFree(&x->level[lv]);
+    }
+    return result;
+}
+
+/* Count the layouts of the ships still afloat that fit known, and how
+   many put a ship on each cell. sunk and afloat as for ComputeHeatMap.
+   Returns -1 (out left empty) if a level would hold more than maxStates
+   states, which happens early in a game when almost nothing is known. */
+int CountFleets(const Board *known, Bitboard sunk, unsigned afloat, int threads,
+                size_t maxStates, Posterior *out) {
+    pthread_once(&exactOnce, BuildExactTables);
+    memset(out, 0, sizeof(*out));
+    ExactSearch *x = calloc(1, sizeof(ExactSearch));
+    if (!x) { perror("calloc"); return -1; }
+    x->blocked = BitboardOr(known->misses, sunk);
+    x->open = BitboardAndNot(known->hits, sunk);
+    x->maxStates = maxStates;
+
+    int order[NUM_SHIPS];
+    for (int s = 0; s < NUM_SHIPS; ++s) {
+        if (!(afloat & (1u << s))) continue;
+        int k = x->n++;
+        while (k > 0 && ships[order[k - 1]].size < ships[s].size) { order[k] = order[k - 1]; --k; }
+        order[k] = s;
+    }
+    for (int i = 0; i < x->n; ++i) x->size[i] = ships[order[i]].size;
+
+    int result = ExactCount(x, threads, &out->layouts, &out->states);
+    if (result == 0) {
+        for (int lv = 0; lv < x->n; ++lv) {
+            const Bitboard *p = placements[x->size[lv]];
+            for (int k = 0; k < x->fitCount[lv]; ++k) {
+                int i = x->fits[lv][k];
+                if (!x->weight[lv][i]) continue;
+                Bitboard cells = p[i];
+                while (BitboardAny(cells)) out->cover[BitboardPopLowest(&cells)] += x->weight[lv][i];
+            }
+        }
+    } else {
+        memset(out, 0, sizeof(*out));
+    }
+    free(x);
+    return result;
+}
+
+/* Shots ChooseExactShot took from an exact count, and from the density
+   fallback, on this thread; --load prints them */
+static _Thread_local unsigned long exactCounted, exactFallback;
+
+/* The open cell most likely to hold a ship by exact count; the density
+   shot when the position has too many layouts to count quickly */
+int ChooseExactShot(const Board *known, Bitboard sunk, unsigned afloat, Rng *rng) {
+    /* chances as fractions of 2^32, so they fit a table entry */
+    uint32_t chance[GRID_CELLS];
+    uint64_t counted;
+    int cached = TTUsable(known, sunk);
+    uint64_t key = TTKey(known, TT_EXACT);
+    if (!cached || !TTProbe(key, chance, &counted)) {
+        Posterior post;
+        counted = CountFleets(known, sunk, afloat, 1, EXACT_MAX_STATES_AI, &post) == 0 && post.layouts > 0;
+        for (int i = 0; i < GRID_CELLS; ++i) {
+            chance[i] = counted ? (uint32_t)((double)post.cover[i] / (double)post.layouts * 4294967295.0) : 0;
+        }
+        if (cached) TTStore(key, chance, counted);
+    }
+    if (!counted) {
+        exactFallback++;
+        return ChooseDensityShot(known, sunk, afloat, rng);
+    }
+    exactCounted++;
+
+    Bitboard shot = BitboardOr(known->hits, known->misses);
+    int best = -1, ties = 0;
+    uint32_t bestChance = 0;
+    for (int i = 0; i < GRID_CELLS; ++i) {
+        if (BitboardTest(shot, i)) continue;
+        if (best < 0 || chance[i] > bestChance) {
+            best = i;
+            bestChance = chance[i];
+            ties = 1;
+        } else if (chance[i] == bestChance && RngBelow(rng, ++ties) == 0) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+/* Computer picks a cell it has not shot at yet.
+   known is the board whose hits and misses show the tried cells; only
+   those and the ships announced as sunk are looked at. A board that just
+   records our shots has no ships: there fleet[s] is set once RecordSunk
+   heard ships[s] go down, and every other ship is still afloat. */
+void ComputerPickShot(const Board *known, Rng *rng, int *row, int *col) {
+    unsigned afloat = known->afloat;
+    if (!BitboardAny(known->ships)) {
+        afloat = (1u << NUM_SHIPS) - 1;
+        for (int s = 0; s < NUM_SHIPS; ++s) {
+            if (BitboardAny(known->fleet[s])) afloat &= ~(1u << s);
+        }
+    }
+    int idx = computerStrategy == AI_RANDOM ? PickRandomOpenCell(known, rng)
+            : computerStrategy == AI_EXACT  ? ChooseExactShot(known, known->sunk, afloat, rng)
+            : ChooseDensityShot(known, known->sunk, afloat, rng);
+    *row = idx / GRID_SIZE;
+    *col = idx % GRID_SIZE;
+}
+
+/* Boards of any size */
+
+/*
+ * Games with --board or --fleet. A WideBoard keeps one byte per cell
+ * instead of bitboards, cells are numbered row * cols + col, and ships are
+ * placed by random tries. The computer aims the same way as on 10x10, but
+ * it counts placements a line at a time: prefix sums over a row (or
+ * column) say which windows of a ship's length are free of misses and sunk
+ * ships and how many open hits each holds, and a difference array adds
+ * each window's weight to its cells. That is O(cells) per ship size
+ * instead of a pass over every placement's cells.
+ */
+
+#define WIDE_PLACE_TRIES 1000 /* tries per ship before placing the fleet again */
+
+typedef struct {
+    uint8_t cell[WIDE_MAX_CELLS];    /* CellStatus of each cell */
+    uint8_t sunk[WIDE_MAX_CELLS];    /* 1 on cells of ships that went down */
+    uint8_t shipAt[WIDE_MAX_CELLS];  /* ship index + 1 for each cell, 0 = water */
+    uint16_t start[MAX_FLEET];       /* first cell of each ship */
+    uint8_t vertical[MAX_FLEET];
+    uint8_t hitsLeft[MAX_FLEET];     /* cells of each ship not hit yet */
+    uint32_t afloat;                 /* bit s set while fleet[s] is afloat */
+    int shipsLeft;
+    int shots;                       /* cells shot at so far */
+} WideBoard;
+
+static inline int WideCell(int row, int col) {
+    return row * boardConfig.cols + col;
+}
+
+/* One try at placing the whole fleet; -1 if a ship found no spot */
+static int WideTryPlaceFleet(WideBoard *b, Rng *rng) {
+    const BoardConfig *cfg = &boardConfig;
+    memset(b, 0, sizeof(*b));
+    for (int s = 0; s < cfg->shipCount; ++s) {
+        int size = cfg->fleet[s].size;
+        int across = size <= cfg->cols, down = size > 1 && size <= cfg->rows;
+        int tries = 0;
+        while (1) {
+            if (++tries > WIDE_PLACE_TRIES) return -1;
+            int vertical = across && down ? RngBelow(rng, 2) : down;
+            int r = RngBelow(rng, cfg->rows - (vertical ? size - 1 : 0));
+            int c = RngBelow(rng, cfg->cols - (vertical ? 0 : size - 1));
+            int step = vertical ? cfg->cols : 1;
+            int first = WideCell(r, c);
+            int i = 0;
+            while (i < size && !b->shipAt[first + i * step]) ++i;
+            if (i < size) continue;
+
+            for (i = 0; i < size; ++i) {
+                b->cell[first + i * step] = SHIP;
+                b->shipAt[first + i * step] = (uint8_t)(s + 1);
+            }
+            b->start[s] = (uint16_t)first;
+            b->vertical[s] = (uint8_t)vertical;
+            b->hitsLeft[s] = (uint8_t)size;
+            break;
+        }
+    }
+    b->afloat = cfg->shipCount == 32 ? 0xFFFFFFFFu : (1u << cfg->shipCount) - 1;
+    b->shipsLeft = cfg->shipCount;
+    return 0;
+}
+
+/* Place the configured fleet at random */
+void WidePlaceFleet(WideBoard *b, Rng *rng) {
+    while (WideTryPlaceFleet(b, rng) < 0) {}
+}
+
+/* ApplyShotToGrid for a WideBoard: same result bits */
+int WideApplyShot(WideBoard *b, int row, int col) {
+    int idx = WideCell(row, col);
+    if (b->cell[idx] == HIT) return 0;
+    if (b->cell[idx] != MISS) b->shots++;
+    int owner = b->shipAt[idx];
+    if (!owner) {
+        b->cell[idx] = MISS;
+        return 0;
+    }
+    b->cell[idx] = HIT;
+    int s = owner - 1;
+    if (--b->hitsLeft[s] > 0) return RESULT_HIT;
+
+    int size = boardConfig.fleet[s].size;
+    int step = b->vertical[s] ? boardConfig.cols : 1;
+    for (int i = 0; i < size; ++i) b->sunk[b->start[s] + i * step] = 1;
+    b->afloat &= ~(1u << s);
+    int result = RESULT_HIT | RESULT_SUNK | (s << RESULT_SHIP_SHIFT);
+    if (--b->shipsLeft == 0) result |= RESULT_WIN;
+    return result;
+}
+
+/* Add the placements of `mult` ships of this size along one line of len
+   cells (first cell, then every step cells) to heat[] */
+static void WideHeatLine(const WideBoard *b, int first, int step, int len, int size,
+                         uint32_t mult, uint32_t *heat) {
+    int blocked[WIDE_MAX_SIDE + 1], open[WIDE_MAX_SIDE + 1];
+    uint32_t add[WIDE_MAX_SIDE + 1];
+    blocked[0] = open[0] = 0;
+    for (int i = 0; i < len; ++i) {
+        int idx = first + i * step;
+        blocked[i + 1] = blocked[i] + (b->cell[idx] == MISS || b->sunk[idx]);
+        open[i + 1] = open[i] + (b->cell[idx] == HIT && !b->sunk[idx]);
+        add[i] = 0;
+    }
+    add[len] = 0;
+    for (int i = 0; i + size <= len; ++i) {
+        if (blocked[i + size] != blocked[i]) continue;
+        uint32_t weight = mult * (1 + (uint32_t)(open[i + size] - open[i]) * TARGET_WEIGHT);
+        add[i] += weight;
+        add[i + size] -= weight;
+    }
+    uint32_t run = 0;
+    for (int i = 0; i < len; ++i) {
+        run += add[i];
+        heat[first + i * step] += run;
+    }
+}
+
+/* ComputeHeatMap for a WideBoard. Only hits, misses, sunk cells and the
+   afloat mask are read. heat[] holds rows * cols counts. */
+void WideHeatMap(const WideBoard *known, uint32_t *heat) {
+    const BoardConfig *cfg = &boardConfig;
+    int cells = cfg->rows * cfg->cols;
+    uint32_t bySize[WIDE_MAX_SIDE + 1] = { 0 };
+    for (int s = 0; s < cfg->shipCount; ++s) {
+        if (known->afloat & (1u << s)) bySize[cfg->fleet[s].size]++;
+    }
+    memset(heat, 0, (size_t)cells * sizeof(heat[0]));
+    for (int size = 1; size <= WIDE_MAX_SIDE; ++size) {
+        if (!bySize[size]) continue;
+        for (int r = 0; r < cfg->rows && size <= cfg->cols; ++r) {
+            WideHeatLine(known, WideCell(r, 0), 1, cfg->cols, size, bySize[size], heat);
+        }
+        /* A one-cell ship lies the same both ways: count it once */
+        for (int c = 0; c < cfg->cols && size > 1 && size <= cfg->rows; ++c) {
+            WideHeatLine(known, c, cfg->cols, cfg->rows, size, bySize[size], heat);
+        }
+    }
+    for (int i = 0; i < cells; ++i) {
+        if (known->cell[i] == HIT || known->cell[i] == MISS) heat[i] = 0;
+    }
+}
+
+/* PickRandomOpenCell for a WideBoard */
+static int WidePickRandomOpenCell(const WideBoard *known, Rng *rng) {
+    int k = RngBelow(rng, boardConfig.rows * boardConfig.cols - known->shots);
+    int i = 0;
+    while (1) {
+        if (known->cell[i] != HIT && known->cell[i] != MISS && k-- == 0) return i;
+        ++i;
+    }
+}
+
+/* ComputerPickShot for a WideBoard */
+void WideComputerPickShot(const WideBoard *known, Rng *rng, int *row, int *col) {
+    int idx = -1;
+    if (computerStrategy != AI_RANDOM) {
+        uint32_t heat[WIDE_MAX_CELLS];
+        WideHeatMap(known, heat);
+        uint32_t bestHeat = 0;
+        int ties = 0;
+        for (int i = 0; i < boardConfig.rows * boardConfig.cols; ++i) {
+            if (heat[i] > bestHeat) {
+                idx = i;
+                bestHeat = heat[i];
+                ties = 1;
+            } else if (heat[i] == bestHeat && bestHeat > 0 && RngBelow(rng, ++ties) == 0) {
+                idx = i;
+            }
+        }
+    }
+    if (idx < 0) idx = WidePickRandomOpenCell(known, rng);
+    *row = idx / boardConfig.cols;
+    *col = idx % boardConfig.cols;
+}
+
+/* Computer against computer on the configured board, like SimulateGame */
+int WideSimulateGame(Rng *rng, int *winner) {
+    WideBoard side[2];
+    WidePlaceFleet(&side[0], rng);
+    WidePlaceFleet(&side[1], rng);
+
+    int turn = 0;
+    int shots = 0;
+    while (1) {
+        WideBoard *them = &side[1 - turn];
+        int row, col;
+        WideComputerPickShot(them, rng, &row, &col);
+        int result = WideApplyShot(them, row, col);
+        shots++;
+        if (result & RESULT_WIN) break;
+        turn = 1 - turn;
+    }
+    *winner = turn;
+    return shots;
+}
+
+/* Draw a WideBoard into the frame: two header lines for the column tens
+   and units, then a row letter and two characters per cell */
+static void WideRender(FrameBuffer *fb, const char *title, const WideBoard *b, int hideShips) {
+    const BoardConfig *cfg = &boardConfig;
+    size_t line = 3 + 2 * (size_t)cfg->cols + 1;
+    FrameAppendf(fb, "\n=== %s ===\n", title);
+    if (sizeof(fb->data) - fb->len < line * (size_t)(cfg->rows + 2) + 1) return;
+
+    char *out = fb->data + fb->len;
+    for (int digit = 0; digit < 2; ++digit) {
+        memcpy(out, "   ", 3);
+        out += 3;
+        for (int c = 0; c < cfg->cols; ++c) {
+            *out++ = ' ';
+            *out++ = digit ? (char)('0' + c % 10) : c < 10 ? ' ' : (char)('0' + c / 10);
+        }
+        *out++ = '\n';
+    }
+    for (int r = 0; r < cfg->rows; ++r) {
+        *out++ = (char)('A' + r);
+        *out++ = ' ';
+        *out++ = ' ';
+        for (int c = 0; c < cfg->cols; ++c) {
+            int cell = b->cell[WideCell(r, c)];
+            *out++ = ' ';
+            *out++ = cell == HIT ? 'X' : cell == MISS ? 'o' : cell == SHIP && !hideShips ? 'S' : '.';
+        }
+        *out++ = '\n';
+    }
+    fb->len = (size_t)(out - fb->data);
+    fb->data[fb->len] = '\0';
+}
+
+/* Single-player on the configured board. Both boards are drawn into one
+   FrameBuffer and written at once, as DisplayWorld does. */
+int RunWideSinglePlayer(Rng *rng) {
+    WideBoard *mine = malloc(sizeof(WideBoard));
+    WideBoard *theirs = malloc(sizeof(WideBoard));
+    if (!mine || !theirs) { perror("malloc"); free(mine); free(theirs); return 1; }
+    WidePlaceFleet(mine, rng);
+    WidePlaceFleet(theirs, rng);
+    const Ship *fleet = boardConfig.fleet;
+
+    printf("Welcome to Battleship (single-player, %dx%d, %d ships).\nType 'quit' at any prompt to exit.\n",
+           boardConfig.rows, boardConfig.cols, boardConfig.shipCount);
+
+    static FrameBuffer fb;
+    while (1) {
+        fb.len = 0;
+        WideRender(&fb, "Your Ships", mine, 0);
+        WideRender(&fb, "Your Shots", theirs, 1);
+        FrameFlush(&fb);
+
+        char input[LINE_BUF];
+        printf("\nEnter your shot (e.g. A5 or %c%d): ", 'A' + boardConfig.rows - 1, boardConfig.cols - 1);
+        fflush(stdout);
+        if (!fgets(input, sizeof(input), stdin)) break;
+        input[strcspn(input, "\n")] = '\0';
+        if (strcasecmp(input, "quit") == 0) {
+            printf("Quitting.\n");
+            break;
+        }
+        int row, col;
+        int parsed = ParseCell(input, boardConfig.rows, boardConfig.cols, &row, &col);
+        if (parsed == -1) {
+            printf("Invalid input.\n");
+            continue;
+        }
+        if (parsed == -2) {
+            printf("Coordinates out of range.\n");
+            continue;
+        }
+        int cell = theirs->cell[WideCell(row, col)];
+        if (cell == HIT || cell == MISS) {
+            printf("You already shot there.\n");
+            continue;
+        }
+
+        int result = WideApplyShot(theirs, row, col);
+        if (result & RESULT_SUNK) printf("You sank the %s at %c%d!\n", fleet[ResultShip(result)].name, 'A'+row, col);
+        else if (result)          printf("You hit a ship at %c%d!\n", 'A'+row, col);
+        else                      printf("You missed at %c%d.\n", 'A'+row, col);
+        if (result & RESULT_WIN) {
+            printf("You won! All opponent ships destroyed.\n");
+            break;
+        }
+
+        int crow, ccol;
+        WideComputerPickShot(mine, rng, &crow, &ccol);
+        int cresult = WideApplyShot(mine, crow, ccol);
+        if (cresult & RESULT_SUNK) printf("Computer sank your %s at %c%d!\n", fleet[ResultShip(cresult)].name, 'A'+crow, ccol);
+        else if (cresult)          printf("Computer hit you at %c%d!\n", 'A'+crow, ccol);
+        else                       printf("Computer missed at %c%d.\n", 'A'+crow, ccol);
+        if (cresult & RESULT_WIN) {
+            printf("Computer won! Your ships are destroyed.\n");
+            break;
+        }
+    }
+
+    free(mine);
+    free(theirs);
+    return 0;
+}
+
+/* Sparse boards */
+
+/*
+ * Boards bigger than 26x99 (up to a million cells a side) never hold a
+ * cell array. A SparseBoard keeps
+ *
+ *   ships   one record per ship: first cell, length, direction, hits left
+ *   index   the ships as segments, one array of horizontal ones sorted by
+ *           (row, first column) and one of vertical ones sorted by
+ *           (column, first row); ships never overlap, so the only ship
+ *           that can cover a cell is the last segment starting at or
+ *           before it on its line: two binary searches, O(log ships)
+ *   shots   an open-addressing hash set from cell to HIT, MISS or
+ *           SPARSE_SUNK (a hit on a ship that went down), O(1)
+ *
+ * so memory grows with ships and shots and not with the board. There is
+ * no heat map: the computer hunts at random cells and, once it has hits
+ * on a ship still afloat, fires at the open end of the longest line of
+ * them. Boards are drawn through a viewport.
+ */
+
+#define SPARSE_SUNK 4               /* shot state past HIT and MISS */
+#define SPARSE_HUNT_TRIES 64        /* random draws before scanning for an open cell */
+#define SPARSE_VIEW_ROWS 20
+#define SPARSE_VIEW_COLS 60
+
+/* Hash set of cells (row * cols + col) with a small state for each */
+typedef struct {
+    uint64_t *keys;   /* cell + 1; 0 is a free slot */
+    uint8_t *state;
+    size_t mask;      /* slots - 1, slots is a power of two */
+    size_t count;
+} CellSet;
+
+typedef struct {
+    int row, col;
+    int size;
+    int vertical;
+    int hitsLeft;
+} SparseShip;
+
+/* A ship on its line: row and first column, or column and first row */
+typedef struct {
+    int line;
+    int first;
+    int ship;
+} SparseSegment;
+
+typedef struct {
+    SparseShip *ships;
+    SparseSegment *across;   /* horizontal ships by (row, col) */
+    SparseSegment *down;     /* vertical ships by (col, row) */
+    int shipCount, acrossCount, downCount;
+    int shipsLeft;
+    CellSet shots;
+    uint64_t *openHits;      /* hit cells of ships not sunk yet (may hold stale ones) */
+    size_t openCount, openCap;
+} SparseBoard;
+
+/* realloc that counts for the simulator and gives up like AllocateGrid */
+static void *SparseRealloc(void *p, size_t bytes) {
+    void *q = realloc(p, bytes);
+    if (!q) { perror("realloc"); exit(EXIT_FAILURE); }
+    allocCount++;
+    return q;
+}
+
+static void SparseFree(void *p) {
+    if (!p) return;
+    freeCount++;
+    free(p);
+}
+
+static inline uint64_t SparseCell(int row, int col) {
+    return (uint64_t)row * (uint64_t)boardConfig.cols + (uint64_t)col;
+}
+
+static inline size_t CellHash(uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xFF51AFD7ED558CCDULL;
+    key ^= key >> 33;
+    return (size_t)key;
+}
+
+void CellSetInit(CellSet *set, size_t slots) {
+    size_t n = 16;
+    while (n < slots) n <<= 1;
+    set->keys = SparseRealloc(NULL, n * sizeof(set->keys[0]));
+    set->state = SparseRealloc(NULL, n);
+    memset(set->keys, 0, n * sizeof(set->keys[0]));
+    set->mask = n - 1;
+    set->count = 0;
+}
+
+void CellSetFree(CellSet *set) {
+    SparseFree(set->keys);
+    SparseFree(set->state);
+    memset(set, 0, sizeof(*set));
+}
+
+/* State stored for cell, or EMPTY */
+static inline int CellSetGet(const CellSet *set, uint64_t cell) {
+    for (size_t i = CellHash(cell) & set->mask; set->keys[i]; i = (i + 1) & set->mask) {
+        if (set->keys[i] == cell + 1) return set->state[i];
+    }
+    return EMPTY;
+}
+
+/* Store state for cell, adding it if new; grows at half full */
+void CellSetPut(CellSet *set, uint64_t cell, int state) {
+    if (2 * (set->count + 1) > set->mask + 1) {
+        CellSet bigger;
+        CellSetInit(&bigger, 2 * (set->mask + 1));
+        for (size_t i = 0; i <= set->mask; ++i) {
+            if (set->keys[i]) CellSetPut(&bigger, set->keys[i] - 1, set->state[i]);
+        }
+        CellSetFree(set);
+        *set = bigger;
+    }
+    size_t i = CellHash(cell) & set->mask;
+    while (set->keys[i] && set->keys[i] != cell + 1) i = (i + 1) & set->mask;
+    if (!set->keys[i]) {
+        set->keys[i] = cell + 1;
+        set->count++;
+    }
+    set->state[i] = (uint8_t)state;
+}
+
+static int CompareSegments(const void *a, const void *b) {
+    const SparseSegment *x = a, *y = b;
+    if (x->line != y->line) return x->line < y->line ? -1 : 1;
+    return (x->first > y->first) - (x->first < y->first);
+}
+
+/* Ship covering (line, pos) among segments sorted by (line, first), or -1 */
+static int SparseFindSegment(const SparseBoard *b, const SparseSegment *seg, int count, int line, int pos) {
+    int lo = 0, hi = count; /* first segment after (line, pos) */
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (seg[mid].line < line || (seg[mid].line == line && seg[mid].first <= pos)) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo == 0) return -1;
+    const SparseSegment *s = &seg[lo - 1];
+    return s->line == line && pos < s->first + b->ships[s->ship].size ? s->ship : -1;
+}
+
+/* Index of the ship on (row, col), or -1 for water */
+int SparseShipAt(const SparseBoard *b, int row, int col) {
+    int s = SparseFindSegment(b, b->across, b->acrossCount, row, col);
+    return s >= 0 ? s : SparseFindSegment(b, b->down, b->downCount, col, row);
+}
+
+/* One try at placing every ship, with the cells taken so far in taken;
+   -1 if a ship found no spot */
+static int SparseTryPlaceFleet(SparseBoard *b, CellSet *taken, Rng *rng) {
+    const BoardConfig *cfg = &boardConfig;
+    b->acrossCount = b->downCount = 0;
+    for (int s = 0; s < b->shipCount; ++s) {
+        SparseShip *ship = &b->ships[s];
+        int size = cfg->fleet[s % cfg->shipCount].size;
+        int across = size <= cfg->cols, down = size > 1 && size <= cfg->rows;
+        int tries = 0;
+        while (1) {
+            if (++tries > WIDE_PLACE_TRIES) return -1;
+            int vertical = across && down ? RngBelow(rng, 2) : down;
+            int r = RngBelow(rng, cfg->rows - (vertical ? size - 1 : 0));
+            int c = RngBelow(rng, cfg->cols - (vertical ? 0 : size - 1));
+            int i = 0;
+            while (i < size && CellSetGet(taken, vertical ? SparseCell(r + i, c) : SparseCell(r, c + i)) == EMPTY) ++i;
+            if (i < size) continue;
+            for (i = 0; i < size; ++i) CellSetPut(taken, vertical ? SparseCell(r + i, c) : SparseCell(r, c + i), SHIP);
+            ship->row = r;
+            ship->col = c;
+            ship->size = size;
+            ship->vertical = vertical;
+            ship->hitsLeft = size;
+            if (vertical) b->down[b->downCount++] = (SparseSegment){ c, r, s };
+            else          b->across[b->acrossCount++] = (SparseSegment){ r, c, s };
+            break;
+        }
+    }
+    return 0;
+}
+
+/* Place --fleets copies of the fleet at random. The cells taken are kept
+   in a CellSet only while placing, to catch overlaps. */
+void SparsePlaceFleet(SparseBoard *b, Rng *rng) {
+    const BoardConfig *cfg = &boardConfig;
+    memset(b, 0, sizeof(*b));
+    b->shipCount = cfg->shipCount * cfg->fleets;
+    b->ships = SparseRealloc(NULL, (size_t)b->shipCount * sizeof(b->ships[0]));
+    b->across = SparseRealloc(NULL, (size_t)b->shipCount * sizeof(b->across[0]));
+    b->down = SparseRealloc(NULL, (size_t)b->shipCount * sizeof(b->down[0]));
+
+    size_t cells = 0;
+    for (int s = 0; s < cfg->shipCount; ++s) cells += (size_t)cfg->fleet[s].size;
+    while (1) {
+        CellSet taken;
+        CellSetInit(&taken, 2 * cells * (size_t)cfg->fleets);
+        int placed = SparseTryPlaceFleet(b, &taken, rng);
+        CellSetFree(&taken);
+        if (placed == 0) break;
+    }
+    qsort(b->across, (size_t)b->acrossCount, sizeof(b->across[0]), CompareSegments);
+    qsort(b->down, (size_t)b->downCount, sizeof(b->down[0]), CompareSegments);
+    b->shipsLeft = b->shipCount;
+    CellSetInit(&b->shots, 1024);
+}
+
+void SparseDestroy(SparseBoard *b) {
+    SparseFree(b->ships);
+    SparseFree(b->across);
+    SparseFree(b->down);
+    SparseFree(b->openHits);
+    CellSetFree(&b->shots);
+}
+
+/* ApplyShotToGrid for a SparseBoard: same result bits, with the index of
+   the ship among all --fleets copies */
+int SparseApplyShot(SparseBoard *b, int row, int col) {
+    uint64_t cell = SparseCell(row, col);
+    int seen = CellSetGet(&b->shots, cell);
+    if (seen == HIT || seen == SPARSE_SUNK) return 0;
+    int s = SparseShipAt(b, row, col);
+    if (s < 0) {
+        CellSetPut(&b->shots, cell, MISS);
+        return 0;
+    }
+    SparseShip *ship = &b->ships[s];
+    if (--ship->hitsLeft > 0) {
+        CellSetPut(&b->shots, cell, HIT);
+        if (b->openCount == b->openCap) {
+            b->openCap = b->openCap ? 2 * b->openCap : 64;
+            b->openHits = SparseRealloc(b->openHits, b->openCap * sizeof(b->openHits[0]));
+        }
+        b->openHits[b->openCount++] = cell;
+        return RESULT_HIT;
+    }
+
+    for (int i = 0; i < ship->size; ++i) {
+        CellSetPut(&b->shots, ship->vertical ? SparseCell(ship->row + i, ship->col)
+                                             : SparseCell(ship->row, ship->col + i), SPARSE_SUNK);
+    }
+    int result = RESULT_HIT | RESULT_SUNK | (s << RESULT_SHIP_SHIFT);
+    if (--b->shipsLeft == 0) result |= RESULT_WIN;
+    return result;
+}
+
+/* Random cell not shot yet. Shots are a small part of a big board, so a
+   few draws nearly always find one; if not, walk on from the last draw. */
+static uint64_t SparseHuntCell(const SparseBoard *known, Rng *rng) {
+    uint64_t area = (uint64_t)boardConfig.rows * (uint64_t)boardConfig.cols;
+    uint64_t cell = 0;
+    for (int i = 0; i < SPARSE_HUNT_TRIES; ++i) {
+        cell = SparseCell(RngBelow(rng, boardConfig.rows), RngBelow(rng, boardConfig.cols));
+        if (CellSetGet(&known->shots, cell) == EMPTY) return cell;
+    }
+    while (CellSetGet(&known->shots, cell) != EMPTY) cell = (cell + 1) % area;
+    return cell;
+}
+
+/* Computer's shot at a SparseBoard. Only the shots set and the open hits
+   are read. Open hits of ships that have since sunk are dropped here. */
+void SparseComputerPickShot(SparseBoard *known, Rng *rng, int *row, int *col) {
+    static const int dr[4] = { -1, 1, 0, 0 }, dc[4] = { 0, 0, -1, 1 };
+    int cols = boardConfig.cols;
+    int64_t best = -1;
+    int bestLen = 0, ties = 0;
+
+    size_t kept = 0;
+    for (size_t i = 0; i < known->openCount; ++i) {
+        uint64_t cell = known->openHits[i];
+        if (CellSetGet(&known->shots, cell) != HIT) continue;
+        known->openHits[kept++] = cell;
+        if (computerStrategy == AI_RANDOM) continue;
+        int r = (int)(cell / (uint64_t)cols), c = (int)(cell % (uint64_t)cols);
+        for (int d = 0; d < 4; ++d) {
+            /* hits behind this one on the line, then the first cell past them ahead */
+            int len = 1, br = r - dr[d], bc = c - dc[d];
+            while (br >= 0 && br < boardConfig.rows && bc >= 0 && bc < cols &&
+                   CellSetGet(&known->shots, SparseCell(br, bc)) == HIT) {
+                ++len;
+                br -= dr[d];
+                bc -= dc[d];
+            }
+            int fr = r + dr[d], fc = c + dc[d];
+            while (fr >= 0 && fr < boardConfig.rows && fc >= 0 && fc < cols &&
+                   CellSetGet(&known->shots, SparseCell(fr, fc)) == HIT) {
+                ++len;
+                fr += dr[d];
+                fc += dc[d];
+            }
+            if (fr < 0 || fr >= boardConfig.rows || fc < 0 || fc >= cols) continue;
+            if (CellSetGet(&known->shots, SparseCell(fr, fc)) != EMPTY) continue;
+            if (len > bestLen) {
+                best = (int64_t)SparseCell(fr, fc);
+                bestLen = len;
+                ties = 1;
+            } else if (len == bestLen && RngBelow(rng, ++ties) == 0) {
+                best = (int64_t)SparseCell(fr, fc);
+            }
+        }
+    }
+    known->openCount = kept;
+
+    uint64_t cell = best >= 0 ? (uint64_t)best : SparseHuntCell(known, rng);
+    *row = (int)(cell / (uint64_t)cols);
+    *col = (int)(cell % (uint64_t)cols);
+}
+
+/* Computer against computer on a sparse board, like SimulateGame */
+int SparseSimulateGame(Rng *rng, int *winner) {
+    SparseBoard side[2];
+    SparsePlaceFleet(&side[0], rng);
+    SparsePlaceFleet(&side[1], rng);
+
+    int turn = 0;
+    int shots = 0;
+    while (1) {
+        SparseBoard *them = &side[1 - turn];
+        int row, col;
+        SparseComputerPickShot(them, rng, &row, &col);
+        int result = SparseApplyShot(them, row, col);
+        shots++;
+        if (result & RESULT_WIN) break;
+        turn = 1 - turn;
+    }
+    SparseDestroy(&side[0]);
+    SparseDestroy(&side[1]);
+    *winner = turn;
+    return shots;
+}
+
+/* Draw into the frame the part of a SparseBoard with (top, left) in its
+   top-left corner: one lookup in the shots set, and one in the ship index,
+   per cell shown */
+static void SparseRender(FrameBuffer *fb, const char *title, const SparseBoard *b, int hideShips, int top, int left) {
+    int rows = boardConfig.rows < SPARSE_VIEW_ROWS ? boardConfig.rows : SPARSE_VIEW_ROWS;
+    int cols = boardConfig.cols < SPARSE_VIEW_COLS ? boardConfig.cols : SPARSE_VIEW_COLS;
+    if (top > boardConfig.rows - rows) top = boardConfig.rows - rows;
+    if (left > boardConfig.cols - cols) left = boardConfig.cols - cols;
+    if (top < 0) top = 0;
+    if (left < 0) left = 0;
+
+    FrameAppendf(fb, "\n=== %s: rows %d-%d, columns %d-%d ===\n", title, top, top + rows - 1, left, left + cols - 1);
+    if (sizeof(fb->data) - fb->len < (size_t)(8 + cols + 1) * (size_t)(rows + 1) + 1) return;
+
+    char *out = fb->data + fb->len;
+    memset(out, ' ', 8);
+    out += 8;
+    for (int c = left; c < left + cols; ++c) *out++ = c % 10 == 0 ? '|' : ' ';
+    *out++ = '\n';
+    for (int r = top; r < top + rows; ++r) {
+        memset(out, ' ', 8); /* the row number, right-aligned in 7 */
+        for (int v = r, k = 6; k >= 0; --k, v /= 10) {
+            out[k] = (char)('0' + v % 10);
+            if (v < 10) break;
+        }
+        out += 8;
+        for (int c = left; c < left + cols; ++c) {
+            int state = CellSetGet(&b->shots, SparseCell(r, c));
+            char ch = state == SPARSE_SUNK || state == HIT ? 'X' : state == MISS ? 'o' : '.';
+            if (ch == '.' && !hideShips && SparseShipAt(b, r, c) >= 0) ch = 'S';
+            *out++ = ch;
+        }
+        *out++ = '\n';
+    }
+    fb->len = (size_t)(out - fb->data);
+    fb->data[fb->len] = '\0';
+}
+
+/* Single-player on a sparse board. Cells are typed as two numbers, "row
+   col"; "view row col" moves the shots viewport there, and it follows your
+   shots otherwise. Your own board is shown around the computer's last shot. */
+int RunSparseSinglePlayer(Rng *rng) {
+    SparseBoard mine, theirs;
+    SparsePlaceFleet(&mine, rng);
+    SparsePlaceFleet(&theirs, rng);
+    const Ship *fleet = boardConfig.fleet;
+    int viewRow = 0, viewCol = 0, lastRow = 0, lastCol = 0;
+
+    printf("Welcome to Battleship (single-player, %dx%d, %d ships).\n"
+           "Shots are typed as row and column numbers, e.g. 120 4031; 'view 500 500' moves the view.\n"
+           "Type 'quit' at any prompt to exit.\n",
+           boardConfig.rows, boardConfig.cols, mine.shipCount);
+
+    static FrameBuffer fb;
+    while (1) {
+        fb.len = 0;
+        SparseRender(&fb, "Your Ships", &mine, 0, lastRow - SPARSE_VIEW_ROWS / 2, lastCol - SPARSE_VIEW_COLS / 2);
+        SparseRender(&fb, "Your Shots", &theirs, 1, viewRow - SPARSE_VIEW_ROWS / 2, viewCol - SPARSE_VIEW_COLS / 2);
+        FrameFlush(&fb);
+
+        char input[LINE_BUF];
+        printf("\nShips left: yours %d, computer's %d. Enter your shot (row col): ", mine.shipsLeft, theirs.shipsLeft);
+        fflush(stdout);
+        if (!fgets(input, sizeof(input), stdin)) break;
+        input[strcspn(input, "\n")] = '\0';
+        if (strcasecmp(input, "quit") == 0) {
+            printf("Quitting.\n");
+            break;
+        }
+        int view = strncasecmp(input, "view", 4) == 0;
+        int row, col;
+        if (sscanf(input + (view ? 4 : 0), "%d%*[ ,]%d", &row, &col) != 2) {
+            printf("Invalid input.\n");
+            continue;
+        }
+        if (row < 0 || row >= boardConfig.rows || col < 0 || col >= boardConfig.cols) {
+            printf("Coordinates out of range.\n");
+            continue;
+        }
+        viewRow = row;
+        viewCol = col;
+        if (view) continue;
+        if (CellSetGet(&theirs.shots, SparseCell(row, col)) != EMPTY) {
+            printf("You already shot there.\n");
+            continue;
+        }
+
+        int result = SparseApplyShot(&theirs, row, col);
+        int s = ResultShip(result) % boardConfig.shipCount;
+        if (result & RESULT_SUNK) printf("You sank the %s at %d,%d!\n", fleet[s].name, row, col);
+        else if (result)          printf("You hit a ship at %d,%d!\n", row, col);
+        else                      printf("You missed at %d,%d.\n", row, col);
+        if (result & RESULT_WIN) {
+            printf("You won! All opponent ships destroyed.\n");
+            break;
+        }
+
+        SparseComputerPickShot(&mine, rng, &lastRow, &lastCol);
+        int cresult = SparseApplyShot(&mine, lastRow, lastCol);
+        s = ResultShip(cresult) % boardConfig.shipCount;
+        if (cresult & RESULT_SUNK) printf("Computer sank your %s at %d,%d!\n", fleet[s].name, lastRow, lastCol);
+        else if (cresult)          printf("Computer hit you at %d,%d!\n", lastRow, lastCol);
+        else                       printf("Computer missed at %d,%d.\n", lastRow, lastCol);
+        if (cresult & RESULT_WIN) {
+            printf("Computer won! Your ships are destroyed.\n");
+            break;
+        }
+    }
+
+    SparseDestroy(&mine);
+    SparseDestroy(&theirs);
+    return 0;
+}
+
+/* Replay log */
+
+/*
+ * --record FILE writes every game played (simulated, single-player, served
+ * or two-player) to a compact binary replay file, so an odd game can be
+ * looked at and played back later. The file is
+ *
+ *   header  "BSRP", version, GRID_SIZE, NUM_SHIPS, 0
+ *   record  u32    size of the rest of the record (little-endian)
+ *           u64    seed the game's Rng started from
+ *           u8     flags: REPLAY_FINISHED, REPLAY_SIDE1_WON, REPLAY_FLEET0/1
+ *           u8     source: REPLAY_SIM, REPLAY_SINGLE, ...
+ *           varint number of shots
+ *           varint per ship of each known fleet: first cell * 2 + vertical
+ *           varint per shot: the cell; side 0 fires the even shots
+ *
+ * A 10x10 game is about 100 bytes. Records are built in a per-thread
+ * buffer and written to the file in large appends. The reader maps the
+ * whole file and hands out views into it: finding the next game is one
+ * size read, and shots are decoded only if someone walks them.
+ */
+
+#define REPLAY_MAGIC "BSRP"
+#define REPLAY_VERSION 1
+#define REPLAY_HEADER 8
+#define REPLAY_BUF (1 << 20)
+#define REPLAY_MAX_SHOTS (2 * GRID_CELLS)
+#define REPLAY_RECORD_MAX (4 + 8 + 2 + 5 + 2 * NUM_SHIPS * 5 + REPLAY_MAX_SHOTS * 5)
+
+#define REPLAY_FINISHED  0x01 /* somebody won */
+#define REPLAY_SIDE1_WON 0x02
+#define REPLAY_FLEET0    0x04 /* side 0's fleet is in the record */
+#define REPLAY_FLEET1    0x08
+
+typedef enum { REPLAY_SIM, REPLAY_SINGLE, REPLAY_SERVER, REPLAY_TWO_PLAYER } ReplaySource;
+
+/* One game while it is being played */
+typedef struct {
+    uint64_t seed;
+    uint8_t flags;
+    uint8_t source;
+    int shots;
+    Bitboard fleet[2][NUM_SHIPS];
+    uint16_t cell[REPLAY_MAX_SHOTS];
+} ReplayRecord;
+
+/* Output file shared by every writer */
+typedef struct {
+    int fd;
+    pthread_mutex_t lock;
+    uint64_t games;
+    uint64_t bytes;
+} ReplayFile;
+
+/* Buffered appends for one thread */
+typedef struct {
+    ReplayFile *file;
+    size_t len;
+    uint64_t games;  /* games in buf */
+    uint8_t *buf;
+} ReplayWriter;
+
+/* Set by --record; NULL when nothing is recorded */
+static ReplayFile *replayOut = NULL;
+static const char *replayPath = NULL;
+
+/* Writer for the interactive modes and the server */
+static ReplayWriter replayWriter;
+
+/* Seconds from a monotonic clock */
+double NowSeconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static inline uint8_t *VarintPut(uint8_t *p, uint32_t v) {
+    while (v >= 0x80) {
+        *p++ = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+/* Decode one varint; returns NULL if it runs past end */
+static inline const uint8_t *VarintGet(const uint8_t *p, const uint8_t *end, uint32_t *v) {
+    if (p < end && *p < 0x80) {
+        *v = *p;
+        return p + 1;
+    }
+    uint32_t x = 0;
+    for (int shift = 0; p < end && shift < 35; shift += 7) {
+        uint8_t byte = *p++;
+        x |= (uint32_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            *v = x;
+            return p;
+        }
+    }
+    return NULL;
+}
+
+/* Start recording a game */
+void ReplayBegin(ReplayRecord *rec, uint64_t seed, ReplaySource source) {
+    rec->seed = seed;
+    rec->flags = 0;
+    rec->source = (uint8_t)source;
+    rec->shots = 0;
+}
+
+/* Keep the fleet of one side (from a board RandomlyPlaceShips filled) */
+void ReplaySetFleet(ReplayRecord *rec, int side, const Board *grid) {
+    memcpy(rec->fleet[side], grid->fleet, sizeof(rec->fleet[side]));
+    rec->flags |= side ? REPLAY_FLEET1 : REPLAY_FLEET0;
+}
+
+/* Add the next shot; sides take turns starting with side 0 */
+static inline void ReplayAddShot(ReplayRecord *rec, int row, int col) {
+    if (rec->shots < REPLAY_MAX_SHOTS) rec->cell[rec->shots++] = (uint16_t)CellIndex(row, col);
+}
+
+void ReplaySetWinner(ReplayRecord *rec, int side) {
+    rec->flags |= REPLAY_FINISHED | (side ? REPLAY_SIDE1_WON : 0);
+}
+
+/* Encode a record into out (at least REPLAY_RECORD_MAX bytes); returns its size */
+size_t ReplayEncode(const ReplayRecord *rec, uint8_t *out) {
+    uint8_t *p = out + 4;
+    for (int i = 0; i < 8; ++i) *p++ = (uint8_t)(rec->seed >> (8 * i));
+    *p++ = rec->flags;
+    *p++ = rec->source;
+    p = VarintPut(p, (uint32_t)rec->shots);
+    for (int side = 0; side < 2; ++side) {
+        if (!(rec->flags & (side ? REPLAY_FLEET1 : REPLAY_FLEET0))) continue;
+        for (int s = 0; s < NUM_SHIPS; ++s) {
+            Bitboard cells = rec->fleet[side][s];
+            int first = BitboardPopLowest(&cells);
+            int vertical = ships[s].size > 1 && BitboardTest(rec->fleet[side][s], first + GRID_SIZE);
+            p = VarintPut(p, (uint32_t)(first * 2 + vertical));
+        }
+    }
+    for (int i = 0; i < rec->shots; ++i) p = VarintPut(p, rec->cell[i]);
+
+    uint32_t size = (uint32_t)(p - out - 4);
+    for (int i = 0; i < 4; ++i) out[i] = (uint8_t)(size >> (8 * i));
+    return (size_t)(p - out);
+}
+
+/* Create the replay file and write its header */
+ReplayFile *ReplayFileOpen(const char *path) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) { perror(path); return NULL; }
+    uint8_t header[REPLAY_HEADER] = { 'B', 'S', 'R', 'P', REPLAY_VERSION, GRID_SIZE, NUM_SHIPS, 0 };
+    if (write(fd, header, sizeof(header)) != (ssize_t)sizeof(header)) {
+        perror("write");
+        close(fd);
+        return NULL;
+    }
+    ReplayFile *file = calloc(1, sizeof(ReplayFile));
+    if (!file) { perror("calloc"); close(fd); return NULL; }
+    file->fd = fd;
+    file->bytes = REPLAY_HEADER;
+    pthread_mutex_init(&file->lock, NULL);
+    return file;
+}
+
+/* Write everything buffered to the file in one append */
+int ReplayWriterFlush(ReplayWriter *w) {
+    if (!w->file || w->len == 0) return 0;
+    int rc = 0;
+    pthread_mutex_lock(&w->file->lock);
+    size_t done = 0;
+    while (done < w->len) {
+        ssize_t n = write(w->file->fd, w->buf + done, w->len - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) { perror("replay write"); rc = -1; break; }
+        done += (size_t)n;
+    }
+    w->file->bytes += done;
+    w->file->games += w->games;
+    pthread_mutex_unlock(&w->file->lock);
+    w->len = 0;
+    w->games = 0;
+    return rc;
+}
+
+int ReplayWriterInit(ReplayWriter *w, ReplayFile *file) {
+    w->file = file;
+    w->len = 0;
+    w->games = 0;
+    w->buf = malloc(REPLAY_BUF);
+    if (!w->buf) { perror("malloc"); w->file = NULL; return -1; }
+    return 0;
+}
+
+void ReplayWriterDestroy(ReplayWriter *w) {
+    ReplayWriterFlush(w);
+    free(w->buf);
+    w->buf = NULL;
+    w->file = NULL;
+}
+
+/* Buffer one finished game; does nothing if the writer is not open */
+void ReplayAppend(ReplayWriter *w, const ReplayRecord *rec) {
+    if (!w->file) return;
+    if (REPLAY_BUF - w->len < REPLAY_RECORD_MAX) ReplayWriterFlush(w);
+    w->len += ReplayEncode(rec, w->buf + w->len);
+    w->games++;
+}
+
+/* Flush the shared writer and close the file (atexit) */
+static void ReplayFinish(void) {
+    if (!replayOut) return;
+    ReplayWriterDestroy(&replayWriter);
+    close(replayOut->fd);
+    fprintf(stderr, "Recorded %llu games (%llu bytes) to %s\n",
+            (unsigned long long)replayOut->games, (unsigned long long)replayOut->bytes, replayPath);
+    pthread_mutex_destroy(&replayOut->lock);
+    free(replayOut);
+    replayOut = NULL;
+}
+
+/* Reading replays */
+
+/* A mapped replay file */
+typedef struct {
+    const uint8_t *data;
+    size_t size;
+    size_t pos;
+} ReplayReader;
+
+/* One game inside the mapping */
+typedef struct {
+    uint64_t seed;
+    int flags;
+    int source;
+    int shots;
+    const uint8_t *fleet;  /* varints, NUM_SHIPS per known fleet */
+    const uint8_t *end;    /* end of the record */
+} ReplayView;
+
+int ReplayOpen(ReplayReader *r, const char *path) {
+    memset(r, 0, sizeof(*r));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) { perror(path); return -1; }
+    struct stat st;
+    if (fstat(fd, &st) < 0) { perror("fstat"); close(fd); return -1; }
+    if ((size_t)st.st_size < REPLAY_HEADER) {
+        fprintf(stderr, "%s: not a replay file\n", path);
+        close(fd);
+        return -1;
+    }
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) { perror("mmap"); return -1; }
+    madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+    const uint8_t *h = map;
+    if (memcmp(h, REPLAY_MAGIC, 4) != 0 || h[4] != REPLAY_VERSION ||
+        h[5] != GRID_SIZE || h[6] != NUM_SHIPS) {
+        fprintf(stderr, "%s: not a replay file for this board\n", path);
+        munmap(map, (size_t)st.st_size);
+        return -1;
+    }
+    r->data = map;
+    r->size = (size_t)st.st_size;
+    r->pos = REPLAY_HEADER;
+    return 0;
+}
+
+void ReplayClose(ReplayReader *r) {
+    if (r->data) munmap((void *)r->data, r->size);
+    r->data = NULL;
+}
+
+/* Step to the next game. Returns 1, 0 at the end, or -1 if the file is cut off. */
+int ReplayNext(ReplayReader *r, ReplayView *v) {
+    if (r->pos == r->size) return 0;
+    if (r->size - r->pos < 15) return -1;
+    const uint8_t *p = r->data + r->pos;
+    uint32_t size = (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+    if (size < 11 || r->size - r->pos - 4 < size) return -1;
+    v->end = p + 4 + size;
+    v->seed = 0;
+    for (int i = 0; i < 8; ++i) v->seed |= (uint64_t)p[4 + i] << (8 * i);
+    v->flags = p[12];
+    v->source = p[13];
+    uint32_t shots;
+    v->fleet = VarintGet(p + 14, v->end, &shots);
+    if (!v->fleet) return -1;
+    v->shots = (int)shots;
+    r->pos += 4 + size;
+    return 1;
+}
+
+/* Rebuild the boards of the known fleets and return where the shots start
+   (NULL if the record is broken) */
+const uint8_t *ReplayLoadFleets(const ReplayView *v, Board board[2]) {
+    const uint8_t *p = v->fleet;
+    memset(board, 0, 2 * sizeof(Board));
+    for (int side = 0; side < 2; ++side) {
+        if (!(v->flags & (side ? REPLAY_FLEET1 : REPLAY_FLEET0))) continue;
+        for (int s = 0; s < NUM_SHIPS; ++s) {
+            uint32_t x;
+            if (!(p = VarintGet(p, v->end, &x))) return NULL;
+            int first = (int)(x >> 1), vertical = (int)(x & 1), size = ships[s].size;
+            int r = first / GRID_SIZE, c = first % GRID_SIZE;
+            if (first >= GRID_CELLS || (vertical ? r + size > GRID_SIZE : c + size > GRID_SIZE)) return NULL;
+            BoardAddShip(&board[side], s, ShipMask(r, c, size, vertical));
+        }
+    }
+    return p;
+}
+
+/* Check the packed form of the boards mid-replay (see PackedRoundTripOk) */
+static int ReplayPackedOk(const Board board[2]) {
+    GameState side[2];
+    memset(side, 0, sizeof(side));
+    for (int i = 0; i < 2; ++i) side[i].playerShips = board[i];
+    return PackedRoundTripOk(side);
+}
+
+/* Play the shots back on the known fleets. Returns 1 if the game ends the
+   way the record says (or cannot be checked), 0 if not, -1 if broken.
+   Halfway and at the end the boards also go through PackGame and
+   UnpackGame; *packedOk is cleared if they do not come back the same. */
+int ReplayVerify(const ReplayView *v, int *packedOk) {
+    Board board[2];
+    const uint8_t *p = ReplayLoadFleets(v, board);
+    if (!p) return -1;
+    int result = 0;
+    *packedOk = 1;
+    for (int i = 0; i < v->shots; ++i) {
+        uint32_t cell;
+        if (!(p = VarintGet(p, v->end, &cell)) || cell >= GRID_CELLS) return -1;
+        if (i == v->shots / 2 && !ReplayPackedOk(board)) *packedOk = 0;
+        int target = 1 - (i & 1);
+        if (!(v->flags & (target ? REPLAY_FLEET1 : REPLAY_FLEET0))) continue;
+        result = ApplyShotToGrid(&board[target], (int)cell / GRID_SIZE, (int)cell % GRID_SIZE);
+        if ((result & RESULT_WIN) && i != v->shots - 1) return 0; /* game went on after a win */
+    }
+    if (!ReplayPackedOk(board)) *packedOk = 0;
+    if (!(v->flags & REPLAY_FINISHED) || v->shots == 0) return 1;
+    int lastShooter = (v->shots - 1) & 1;
+    if (lastShooter != ((v->flags & REPLAY_SIDE1_WON) ? 1 : 0)) return 0;
+    int loser = 1 - lastShooter;
+    if (!(v->flags & (loser ? REPLAY_FLEET1 : REPLAY_FLEET0))) return 1;
+    return (result & RESULT_WIN) != 0;
+}
+
+/* Print one game as a line of text */
+void ReplayDumpGame(const ReplayView *v) {
+    static const char *sourceNames[] = { "sim", "single", "server", "two-player" };
+    const char *winner = !(v->flags & REPLAY_FINISHED) ? "-" : (v->flags & REPLAY_SIDE1_WON) ? "1" : "0";
+    printf("seed=%llu source=%s winner=%s shots=%d:", (unsigned long long)v->seed,
+           v->source < 4 ? sourceNames[v->source] : "?", winner, v->shots);
+    Board board[2];
+    const uint8_t *p = ReplayLoadFleets(v, board);
+    for (int i = 0; p && i < v->shots; ++i) {
+        uint32_t cell;
+        if (!(p = VarintGet(p, v->end, &cell))) break;
+        printf(" %c%u", 'A' + (int)(cell / GRID_SIZE), cell % GRID_SIZE);
+    }
+    printf("\n");
+}
+
+/* --replay FILE [--verify] [--dump]: walk a replay file and print what is in it */
+int RunReplayScan(const char *path, int verify, int dump) {
+    static const char *sourceNames[] = { "simulated", "single-player", "server", "two-player" };
+    ReplayReader reader;
+    if (ReplayOpen(&reader, path) < 0) return 1;
+
+    double start = NowSeconds();
+    uint64_t games = 0, shots = 0, finished = 0, side0Wins = 0, bad = 0, broken = 0, unpacked = 0;
+    uint64_t bySource[4] = { 0, 0, 0, 0 };
+    ReplayView v;
+    int got;
+    while ((got = ReplayNext(&reader, &v)) > 0) {
+        games++;
+        shots += (uint64_t)v.shots;
+        if (v.source < 4) bySource[v.source]++;
+        if (v.flags & REPLAY_FINISHED) {
+            finished++;
+            if (!(v.flags & REPLAY_SIDE1_WON)) side0Wins++;
+        }
+        if (dump) ReplayDumpGame(&v);
+        if (verify) {
+            int packedOk;
+            int ok = ReplayVerify(&v, &packedOk);
+            if (ok < 0) broken++;
+            else if (!ok) bad++;
+            if (ok >= 0 && !packedOk) unpacked++;
+        }
+    }
+    double elapsed = NowSeconds() - start;
+    if (elapsed <= 0) elapsed = 1e-9;
+    if (got < 0) fprintf(stderr, "%s: file is cut off after %llu games\n", path, (unsigned long long)games);
+
+    printf("games:            %llu\n", (unsigned long long)games);
+    for (int s = 0; s < 4; ++s) {
+        if (bySource[s]) printf("  %-15s %llu\n", sourceNames[s], (unsigned long long)bySource[s]);
+    }
+    printf("finished:         %llu\n", (unsigned long long)finished);
+    if (games) printf("shots/game:       %.2f\n", (double)shots / (double)games);
+    if (finished) printf("first shooter won %.2f%%\n", 100.0 * (double)side0Wins / (double)finished);
+    if (verify) printf("verify:           %llu mismatched, %llu broken, %llu changed when packed\n",
+                       (unsigned long long)bad, (unsigned long long)broken, (unsigned long long)unpacked);
+    printf("seconds:          %.3f\n", elapsed);
+    printf("games/sec:        %.0f\n", (double)games / elapsed);
+    printf("MB/sec:           %.0f\n", (double)reader.size / elapsed / 1e6);
+    ReplayClose(&reader);
+    return got < 0 || bad || broken || unpacked ? 1 : 0;
+}
+
+/* Replay analysis */
+
+/*
+ * --analyze FILE [--threads T] reads a replay file (usually one written by
+ * --simulate --record) and prints game length, how long each side took to
+ * find its first ship, how often each cell is hit and how often the first
+ * shooter wins. The file is cut into chunks of about the same size by
+ * stepping over the record sizes, and worker threads take chunks off an
+ * atomic counter. Every statistic is a fixed-size histogram or counter in
+ * the worker, so memory does not grow with the file; the workers' tables
+ * are added up at the end.
+ */
+
+#define ANALYZE_CHUNKS_PER_THREAD 16
+
+/* Byte range [start, end) of whole records */
+typedef struct {
+    size_t start, end;
+} ReplayChunk;
+
+typedef struct {
+    const ReplayReader *reader;
+    const ReplayChunk *chunks;
+    int chunkCount;
+    atomic_int nextChunk;
+} AnalyzeJob;
+
+/* Counters of one worker; aligned so workers never share a cache line */
+typedef struct {
+    _Alignas(64) AnalyzeJob *job;
+    uint64_t games;
+    uint64_t broken;
+    uint64_t boards;                          /* target fleets seen */
+    uint64_t finished[4], firstWins[4];       /* by ReplaySource */
+    uint64_t length[REPLAY_MAX_SHOTS + 1];    /* shots per game */
+    uint64_t firstHit[GRID_CELLS + 1];        /* own shots before the first hit */
+    uint64_t hits[GRID_CELLS];
+} ReplayStats;
+
+/* Ship cells of each known fleet; returns where the shots start (NULL if broken) */
+static const uint8_t *ReplayFleetCells(const ReplayView *v, Bitboard fleet[2]) {
+    const uint8_t *p = v->fleet;
+    for (int side = 0; side < 2; ++side) {
+        fleet[side].lo = fleet[side].hi = 0;
+        if (!(v->flags & (side ? REPLAY_FLEET1 : REPLAY_FLEET0))) continue;
+        for (int s = 0; s < NUM_SHIPS; ++s) {
+            uint32_t x;
+            if (!(p = VarintGet(p, v->end, &x)) || (x >> 1) >= GRID_CELLS) return NULL;
+            int first = (int)(x >> 1), step = (x & 1) ? GRID_SIZE : 1;
+            for (int i = 0; i < ships[s].size && first + i * step < GRID_CELLS; ++i) {
+                BitboardSet(&fleet[side], first + i * step);
+            }
+        }
+    }
+    return p;
+}
+
+static void AnalyzeGame(ReplayStats *st, const ReplayView *v) {
+    Bitboard fleet[2];
+    const uint8_t *p = ReplayFleetCells(v, fleet);
+    if (!p) { st->broken++; return; }
+    int known[2] = { (v->flags & REPLAY_FLEET0) != 0, (v->flags & REPLAY_FLEET1) != 0 };
+    int fired[2] = { 0, 0 };
+    int firstHit[2] = { -1, -1 };
+    for (int i = 0; i < v->shots; ++i) {
+        uint32_t cell;
+        if (!(p = VarintGet(p, v->end, &cell)) || cell >= GRID_CELLS) { st->broken++; return; }
+        int side = i & 1, target = 1 - side;
+        if (known[target] && BitboardTest(fleet[target], (int)cell)) {
+            st->hits[cell]++;
+            if (firstHit[side] < 0) firstHit[side] = fired[side];
+        }
+        fired[side]++;
+    }
+
+    st->games++;
+    st->length[v->shots <= REPLAY_MAX_SHOTS ? v->shots : REPLAY_MAX_SHOTS]++;
+    for (int target = 0; target < 2; ++target) {
+        if (!known[target]) continue;
+        int side = 1 - target;
+        st->boards++;
+        st->firstHit[firstHit[side] < 0 ? GRID_CELLS : firstHit[side]]++;
+    }
+    int source = v->source < 4 ? v->source : REPLAY_SIM;
+    if (v->flags & REPLAY_FINISHED) {
+        st->finished[source]++;
+        if (!(v->flags & REPLAY_SIDE1_WON)) st->firstWins[source]++;
+    }
+}
+
+void *AnalyzeWorker(void *arg) {
+    ReplayStats *st = arg;
+    AnalyzeJob *job = st->job;
+    while (1) {
+        int c = atomic_fetch_add(&job->nextChunk, 1);
+        if (c >= job->chunkCount) break;
+        ReplayReader r = *job->reader;
+        r.size = job->chunks[c].end;
+        r.pos = job->chunks[c].start;
+        ReplayView v;
+        while (ReplayNext(&r, &v) > 0) AnalyzeGame(st, &v);
+    }
+    return NULL;
+}
+
+/* Cut the file into about maxChunks ranges of whole records.
+   Returns the number of chunks, or -1 if the file is cut off. */
+static int ReplaySplit(const ReplayReader *r, ReplayChunk *chunks, int maxChunks) {
+    size_t target = (r->size - REPLAY_HEADER) / (size_t)maxChunks + 1;
+    size_t pos = REPLAY_HEADER, start = pos;
+    int n = 0;
+    while (pos < r->size) {
+        if (r->size - pos < 4) return -1;
+        const uint8_t *p = r->data + pos;
+        size_t size = (size_t)p[0] | (size_t)p[1] << 8 | (size_t)p[2] << 16 | (size_t)p[3] << 24;
+        if (r->size - pos - 4 < size) return -1;
+        pos += 4 + size;
+        if (pos - start >= target && n < maxChunks - 1) {
+            chunks[n].start = start;
+            chunks[n++].end = pos;
+            start = pos;
+        }
+    }
+    if (pos > start) {
+        chunks[n].start = start;
+        chunks[n++].end = pos;
+    }
+    return n;
+}
+
+/* Value at fraction q of a histogram holding total entries */
+static int HistogramPercentile(const uint64_t *h, int buckets, uint64_t total, double q) {
+    uint64_t want = (uint64_t)(q * (double)total);
+    uint64_t seen = 0;
+    for (int i = 0; i < buckets; ++i) {
+        seen += h[i];
+        if (seen > want) return i;
+    }
+    return buckets - 1;
+}
+
+static double HistogramMean(const uint64_t *h, int buckets, uint64_t total) {
+    double sum = 0;
+    for (int i = 0; i < buckets; ++i) sum += (double)i * (double)h[i];
+    return total ? sum / (double)total : 0;
+}
+
+int RunReplayAnalysis(const char *path, int threads) {
+    static const char *sourceNames[] = { "simulated", "single-player", "server", "two-player" };
+    if (threads < 1) threads = 1;
+    ReplayReader reader;
+    if (ReplayOpen(&reader, path) < 0) return 1;
+
+    double start = NowSeconds();
+    int maxChunks = threads * ANALYZE_CHUNKS_PER_THREAD;
+    ReplayChunk *chunks = calloc((size_t)maxChunks, sizeof(ReplayChunk));
+    /* aligned_alloc: calloc would not keep the stats on separate cache lines */
+    ReplayStats *stats = aligned_alloc(_Alignof(ReplayStats), (size_t)threads * sizeof(ReplayStats));
+    pthread_t *tids = calloc((size_t)threads, sizeof(pthread_t));
+    if (!chunks || !stats || !tids) {
+        perror("alloc");
+        free(chunks); free(stats); free(tids);
+        ReplayClose(&reader);
+        return 1;
+    }
+    memset(stats, 0, (size_t)threads * sizeof(ReplayStats));
+    AnalyzeJob job;
+    job.reader = &reader;
+    job.chunks = chunks;
+    job.chunkCount = ReplaySplit(&reader, chunks, maxChunks);
+    atomic_init(&job.nextChunk, 0);
+    if (job.chunkCount < 0) {
+        fprintf(stderr, "%s: file is cut off\n", path);
+        job.chunkCount = 0;
+    }
+
+    for (int t = 0; t < threads; ++t) {
+        stats[t].job = &job;
+        if (pthread_create(&tids[t], NULL, AnalyzeWorker, &stats[t]) != 0) {
+            perror("pthread_create");
+            threads = t;
+            break;
+        }
+    }
+    ReplayStats *total = &stats[0];
+    if (threads == 0) AnalyzeWorker(total); /* could not start any thread */
+    for (int t = 0; t < threads; ++t) pthread_join(tids[t], NULL);
+    for (int t = 1; t < threads; ++t) {
+        const ReplayStats *st = &stats[t];
+        total->games += st->games;
+        total->broken += st->broken;
+        total->boards += st->boards;
+        for (int s = 0; s < 4; ++s) {
+            total->finished[s] += st->finished[s];
+            total->firstWins[s] += st->firstWins[s];
+        }
+        for (int i = 0; i <= REPLAY_MAX_SHOTS; ++i) total->length[i] += st->length[i];
+        for (int i = 0; i <= GRID_CELLS; ++i) total->firstHit[i] += st->firstHit[i];
+        for (int i = 0; i < GRID_CELLS; ++i) total->hits[i] += st->hits[i];
+    }
+    double elapsed = NowSeconds() - start;
+    if (elapsed <= 0) elapsed = 1e-9;
+
+    printf("games:            %llu\n", (unsigned long long)total->games);
+    printf("threads:          %d\n", threads > 0 ? threads : 1);
+    printf("seconds:          %.3f\n", elapsed);
+    printf("games/sec:        %.0f\n", (double)total->games / elapsed);
+    if (total->broken) printf("broken records:   %llu\n", (unsigned long long)total->broken);
+    if (total->games) {
+        const uint64_t *h = total->length;
+        int n = REPLAY_MAX_SHOTS + 1;
+        printf("shots/game:       mean %.2f  p50 %d  p90 %d  p99 %d\n", HistogramMean(h, n, total->games),
+               HistogramPercentile(h, n, total->games, 0.5), HistogramPercentile(h, n, total->games, 0.9),
+               HistogramPercentile(h, n, total->games, 0.99));
+    }
+    if (total->boards) {
+        const uint64_t *h = total->firstHit;
+        int n = GRID_CELLS + 1;
+        printf("first hit after:  mean %.2f  p50 %d  p90 %d  p99 %d shots\n", HistogramMean(h, n, total->boards),
+               HistogramPercentile(h, n, total->boards, 0.5), HistogramPercentile(h, n, total->boards, 0.9),
+               HistogramPercentile(h, n, total->boards, 0.99));
+    }
+    for (int s = 0; s < 4; ++s) {
+        if (!total->finished[s]) continue;
+        printf("first shooter won %5.2f%% of %llu %s games\n",
+               100.0 * (double)total->firstWins[s] / (double)total->finished[s],
+               (unsigned long long)total->finished[s], sourceNames[s]);
+    }
+    if (total->boards) {
+        printf("\nCells hit (%% of boards):\n    ");
+        for (int c = 0; c < GRID_SIZE; ++c) printf("%5d", c);
+        printf("\n");
+        for (int r = 0; r < GRID_SIZE; ++r) {
+            printf("%c   ", 'A' + r);
+            for (int c = 0; c < GRID_SIZE; ++c) {
+                printf("%5.1f", 100.0 * (double)total->hits[CellIndex(r, c)] / (double)total->boards);
+            }
+            printf("\n");
+        }
+    }
+
+    int rc = total->broken ? 1 : 0;
+    free(chunks);
+    free(stats);
+    free(tids);
+    ReplayClose(&reader);
+    return rc;
+}
+
+/* Latency histograms */
+
+/*
+ * Log-linear histogram in the style of HdrHistogram: values below 16 get a
+ * bucket each, and every power of two above that is split into 16 equal
+ * buckets, so any recorded value is known to within about 6%. Recording is
+ * one bit scan and an increment, and the table has a fixed size however
+ * many values go in.
+ */
+
+#define LAT_SUB_BITS 4
+#define LAT_SUB (1 << LAT_SUB_BITS)
+#define LAT_BUCKETS (64 * LAT_SUB)
+
+/* Counters that one thread writes while another may read them (an event
+   loop's, read by SIGUSR1 or the metrics thread) are _Atomic and only
+   touched through these. The one writer needs no read-modify-write, so a
+   relaxed load and store do: on x86 they are the same plain moves as an
+   ordinary increment, but the concurrent reads are well defined. */
+#define COUNTER_GET(c)    atomic_load_explicit(&(c), memory_order_relaxed)
+#define COUNTER_SET(c, v) atomic_store_explicit(&(c), (v), memory_order_relaxed)
+#define COUNTER_ADD(c, n) COUNTER_SET(c, COUNTER_GET(c) + (n))
+
+typedef struct {
+    _Atomic uint64_t count[LAT_BUCKETS];
+    _Atomic uint64_t total;
+    _Atomic uint64_t max;
+    _Atomic uint64_t sum;   /* of every value, in nanoseconds */
+} LatencyHistogram;
+
+/* Nanoseconds from a monotonic clock */
+static inline uint64_t NowNanos(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static inline int LatencyBucket(uint64_t v) {
+    if (v < LAT_SUB) return (int)v;
+    int shift = 63 - __builtin_clzll(v) - LAT_SUB_BITS;
+    return (shift + 1) * LAT_SUB + (int)((v >> shift) & (LAT_SUB - 1));
+}
+
+/* Smallest value that lands in bucket b */
+static inline uint64_t LatencyBucketValue(int b) {
+    if (b < LAT_SUB) return (uint64_t)b;
+    int shift = b / LAT_SUB - 1;
+    return (uint64_t)(LAT_SUB + b % LAT_SUB) << shift;
+}
+
+static inline void LatencyRecord(LatencyHistogram *h, uint64_t v) {
+    COUNTER_ADD(h->count[LatencyBucket(v)], 1);
+    COUNTER_ADD(h->total, 1);
+    COUNTER_ADD(h->sum, v);
+    if (v > COUNTER_GET(h->max)) COUNTER_SET(h->max, v);
+}
+
+/* Add from into into; from may be another thread's live histogram */
+void LatencyMerge(LatencyHistogram *into, const LatencyHistogram *from) {
+    for (int b = 0; b < LAT_BUCKETS; ++b) COUNTER_ADD(into->count[b], COUNTER_GET(from->count[b]));
+    COUNTER_ADD(into->total, COUNTER_GET(from->total));
+    COUNTER_ADD(into->sum, COUNTER_GET(from->sum));
+    uint64_t max = COUNTER_GET(from->max);
+    if (max > COUNTER_GET(into->max)) COUNTER_SET(into->max, max);
+}
+
+/* Value at fraction q (0..1) of everything recorded */
+uint64_t LatencyPercentile(const LatencyHistogram *h, double q) {
+    uint64_t total = COUNTER_GET(h->total);
+    if (total == 0) return 0;
+    uint64_t want = (uint64_t)(q * (double)(total - 1));
+    uint64_t seen = 0;
+    for (int b = 0; b < LAT_BUCKETS; ++b) {
+        seen += COUNTER_GET(h->count[b]);
+        if (seen > want) return LatencyBucketValue(b);
+    }
+    return COUNTER_GET(h->max);
+}
+
+/* One summary line in microseconds */
+void LatencyPrint(const char *label, const LatencyHistogram *h) {
+    uint64_t total = COUNTER_GET(h->total);
+    if (total == 0) {
+        printf("%-18sno samples\n", label);
+        return;
+    }
+    printf("%-18smean %.1f  p50 %.1f  p99 %.1f  p999 %.1f  max %.1f us (%llu samples)\n", label,
+           (double)COUNTER_GET(h->sum) / (double)total / 1e3,
+           (double)LatencyPercentile(h, 0.50) / 1e3,
+           (double)LatencyPercentile(h, 0.99) / 1e3,
+           (double)LatencyPercentile(h, 0.999) / 1e3,
+           (double)COUNTER_GET(h->max) / 1e3, (unsigned long long)total);
+}
+
+/* Networking helper functions */
+
+/* Send the whole buffer over the socket.
+   Returns how many send() calls it took, or -1. */
+int SendAll(int sockfd, const char *buffer, size_t length) {
+    size_t total_sent = 0;
+    int calls = 0;
+    while (total_sent < length) {
+        ssize_t sent = send(sockfd, buffer + total_sent, length - total_sent, 0);
+        calls++;
+        if (sent <= 0) return -1;
+        total_sent += (size_t)sent;
+    }
+    return calls;
+}
+
+/* Buffered line reader */
+
+/*
+ * Each connection owns a LineReader: a ring buffer filled by one large
+ * recv() at a time and cut into '\n'-terminated lines. Partial lines stay
+ * in the buffer until the rest arrives, and several pipelined lines from
+ * one recv() come out one by one. Lines are handed out as views into the
+ * buffer (the '\n' is replaced by '\0'), so nothing is copied. A line that
+ * wraps past the end of the ring has its start copied into the spare
+ * space after the ring so the view is still one piece.
+ */
+
+#define READER_SIZE 1024          /* ring size, must be a power of two */
+#define READER_LINE_MAX LINE_BUF  /* longest line we accept */
+
+typedef struct {
+    size_t head;  /* bytes handed out so far */
+    size_t tail;  /* bytes received so far */
+    size_t scan;  /* bytes already searched for '\n' */
+    char buf[READER_SIZE + READER_LINE_MAX];
+} LineReader;
+
+/* A line inside a LineReader; valid until the next fill */
+typedef struct {
+    const char *data; /* '\0'-terminated, without the '\n' */
+    size_t len;
+} LineView;
+
+void LineReaderInit(LineReader *r) {
+    r->head = r->tail = r->scan = 0;
+}
+
+/* Bytes received but not yet handed out */
+static inline size_t LineReaderPending(const LineReader *r) {
+    return r->tail - r->head;
+}
+
+/* One read() into the free part of the ring (sockets and stdin alike).
+   Returns bytes read, 0 if the peer closed, -1 on error (errno is kept,
+   so EAGAIN can be told apart on non-blocking sockets). */
+ssize_t LineReaderFill(LineReader *r, int fd) {
+    size_t used = r->tail - r->head;
+    if (used == READER_SIZE) { errno = ENOBUFS; return -1; }
+    size_t pos = r->tail & (READER_SIZE - 1);
+    size_t room = READER_SIZE - used;
+    if (room > READER_SIZE - pos) room = READER_SIZE - pos; /* stop at the wrap */
+    ssize_t n = read(fd, r->buf + pos, room);
+    if (n > 0) r->tail += (size_t)n;
+    return n;
+}
+
+/* Copy bytes that arrived some other way (an io_uring receive buffer)
+   into the ring. Returns -1 if they do not fit. */
+int LineReaderPush(LineReader *r, const char *data, size_t len) {
+    if (READER_SIZE - (r->tail - r->head) < len) return -1;
+    size_t pos = r->tail & (READER_SIZE - 1);
+    size_t first = READER_SIZE - pos;
+    if (first > len) first = len;
+    memcpy(r->buf + pos, data, first);
+    memcpy(r->buf, data + first, len - first);
+    r->tail += len;
+    return 0;
+}
+
+/* Take the next complete line as a view.
+   Returns 1 with *line set, 0 if no full line is buffered yet,
+   -1 if a line is longer than READER_LINE_MAX. */
+int LineReaderNext(LineReader *r, LineView *line) {
+    while (r->scan < r->tail) {
+        size_t pos = r->scan & (READER_SIZE - 1);
+        size_t len = r->tail - r->scan;
+        if (len > READER_SIZE - pos) len = READER_SIZE - pos;
+        char *nl = memchr(r->buf + pos, '\n', len);
+        if (!nl) {
+            r->scan += len;
+            continue;
+        }
+
+        size_t end = r->scan + (size_t)(nl - (r->buf + pos)); /* position of '\n' */
+        size_t start = r->head & (READER_SIZE - 1);
+        size_t lineLen = end - r->head;
+        if (lineLen >= READER_LINE_MAX) return -1;
+
+        char *data = r->buf + start;
+        if (start + lineLen >= READER_SIZE) {
+            /* Wrapped: move the part at the front of the ring after the end */
+            size_t wrapped = start + lineLen + 1 - READER_SIZE;
+            memcpy(r->buf + READER_SIZE, r->buf, wrapped);
+        }
+        data[lineLen] = '\0';
+        line->data = data;
+        line->len = lineLen;
+        r->head = r->scan = end + 1;
+        return 1;
+    }
+    if (r->tail - r->head >= READER_LINE_MAX) return -1;
+    return 0;
+}
+
+/* Blocking read of one line as a view. Returns its length or -1. */
+ssize_t ReceiveLineView(LineReader *r, int sockfd, LineView *line) {
+    while (1) {
+        int got = LineReaderNext(r, line);
+        if (got > 0) return (ssize_t)line->len;
+        if (got < 0) return -1;
+        ssize_t n = LineReaderFill(r, sockfd);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1; /* closed or error */
+    }
+}
+
+/* Read one line (ending with '\n') from the socket.
+   outbuf has space maxlen. Returns number of bytes or -1. */
+ssize_t ReceiveLine(LineReader *r, int sockfd, char *outbuf, size_t maxlen) {
+    LineView line;
+    if (maxlen < 2 || ReceiveLineView(r, sockfd, &line) < 0) return -1;
+    size_t idx = line.len < maxlen - 2 ? line.len : maxlen - 2;
+    memcpy(outbuf, line.data, idx);
+    outbuf[idx++] = '\n';
+    outbuf[idx] = '\0';
+    return (ssize_t)idx;
+}
+
+/* Send formatted text plus a newline to the socket */
+int SendLine(int sockfd, const char *fmt, ...) {
+    char buffer[LINE_BUF];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(buffer, sizeof(buffer), fmt, ap);
+    va_end(ap);
+    if (n < 0) return -1;
+    if ((size_t)n >= sizeof(buffer) - 1) return -1;
+    /* add newline if missing */
+    if (buffer[n-1] != '\n') {
+        if (n + 1 >= (int)sizeof(buffer)) return -1;
+        buffer[n] = '\n';
+        buffer[n+1] = '\0';
+        n++;
+    }
+    return SendAll(sockfd, buffer, (size_t)n) < 0 ? -1 : 0;
+}
+
+/* Wire protocol */
+
+/*
+ * Two encodings share one connection:
+ *
+ * Text (always understood):
+ * - To shoot:   "SHOT r c\n"
+ * - Reply:      "RESULT HIT\n" or "RESULT MISS\n"; the last cell of a ship
+ *                gives "RESULT HIT SUNK Cruiser\n", with " WIN" added
+ *                when it was the last ship
+ * - To quit:    "QUIT\n"
+ *
+ * Binary: fixed 4-byte frames
+ *   byte 0  type   FRAME_SHOT / FRAME_RESULT / FRAME_QUIT (high bit set)
+ *   byte 1  cell   row * GRID_SIZE + col (a RESULT repeats the shot's cell)
+ *   byte 2  flags  RESULT_HIT, RESULT_SUNK, RESULT_WIN; sunk ship id in bits 4..7
+ *   byte 3  seq    per-sender counter, wraps at 256
+ * A text line never starts with a byte >= 0x80, so every message can be
+ * told apart by its first byte.
+ *
+ * Negotiation: a side that speaks binary adds " BIN" to its first text
+ * message ("SHOT 3 4 BIN", "RESULT MISS BIN"). Older peers ignore the extra
+ * word. Once a side has sent its own offer and seen the peer's, it sends
+ * binary frames from then on; both encodings are accepted at any time.
+ */
+
+#define FRAME_SIZE   4
+#define FRAME_SHOT   0x81
+#define FRAME_RESULT 0x82
+#define FRAME_QUIT   0x83
+
+typedef enum { MSG_OTHER, MSG_SHOT, MSG_RESULT, MSG_QUIT } MessageType;
+
+/* One decoded message, from either encoding */
+typedef struct {
+    MessageType type;
+    int row, col;      /* SHOT: target; -1 if it could not be read */
+    int flags;         /* RESULT: RESULT_* bits */
+    int binary;        /* came as a binary frame */
+    int offersBinary;  /* text message carried the BIN offer */
+    int seq;           /* binary frames only */
+    int size;          /* bytes it took on the wire */
+    const char *text;  /* text messages: the line; valid until the next read */
+} Message;
+
+/* Traffic on a connection */
+typedef struct {
+    _Atomic uint64_t msgsIn, msgsOut;
+    _Atomic uint64_t bytesIn, bytesOut;
+    _Atomic uint64_t reads, sends;      /* system calls */
+} NetCounters;
+
+/* Totals for many connections (a session, or everything a server saw) */
+typedef struct {
+    NetCounters io;
+    LatencyHistogram rtt;   /* our SHOT to its RESULT */
+    LatencyHistogram turn;  /* our SHOT to the opponent's next SHOT */
+} NetMetrics;
+
+/* Per-connection protocol state */
+typedef struct {
+    int offerSent;   /* our first message carried BIN */
+    int offerSeen;   /* the peer's did */
+    uint8_t sendSeq;
+    uint8_t recvSeq;
+    NetCounters io;         /* this connection only */
+    NetMetrics *metrics;    /* also counted here if not NULL */
+    uint64_t shotSentAt;    /* NowNanos() of our last SHOT, 0 once answered */
+    uint64_t turnFrom;      /* same, kept until the opponent shoots */
+    uint64_t rttSum, rttMax;
+    uint32_t rttCount;
+} ProtoState;
+
+/* Offer binary on new connections; --text turns this off */
+static int protocolOfferBinary = 1;
+
+/* Frame type byte -> message type; anything else is MSG_OTHER */
+static const uint8_t frameTypes[256] = {
+    [FRAME_SHOT] = MSG_SHOT, [FRAME_RESULT] = MSG_RESULT, [FRAME_QUIT] = MSG_QUIT,
+};
+
+void ProtoInit(ProtoState *p) {
+    memset(p, 0, sizeof(*p));
+}
+
+/* Are we sending binary frames on this connection yet? */
+static inline int ProtoBinary(const ProtoState *p) {
+    return p->offerSent && p->offerSeen;
+}
+
+/* Decode a 4-byte frame with table lookups only.
+   A bad cell comes back as row/col -1. */
+static inline void DecodeFrame(const uint8_t *f, Message *msg) {
+    int cell = f[1];
+    int valid = cell < GRID_CELLS;
+    msg->type = (MessageType)frameTypes[f[0]];
+    msg->row = valid ? cell / GRID_SIZE : -1;
+    msg->col = valid ? cell % GRID_SIZE : -1;
+    msg->flags = f[2];
+    if ((msg->flags & RESULT_SUNK) && ResultShip(msg->flags) >= NUM_SHIPS) {
+        msg->flags &= RESULT_HIT | RESULT_WIN; /* no such ship */
+    }
+    msg->seq = f[3];
+    msg->size = FRAME_SIZE;
+    msg->binary = 1;
+    msg->offersBinary = 0;
+    msg->text = "(binary frame)";
+}
+
+/* Read a text line the same way the old code did */
+void ParseTextMessage(const char *line, Message *msg) {
+    memset(msg, 0, sizeof(*msg));
+    msg->text = line;
+    msg->row = msg->col = -1;
+    msg->offersBinary = strstr(line, " BIN") != NULL;
+    if (strncmp(line, "SHOT", 4) == 0) {
+        msg->type = MSG_SHOT;
+        if (sscanf(line, "SHOT %d %d", &msg->row, &msg->col) != 2) msg->row = msg->col = -1;
+    } else if (strncmp(line, "RESULT", 6) == 0) {
+        msg->type = MSG_RESULT;
+        if (strstr(line, "HIT")) msg->flags |= RESULT_HIT;
+        const char *sunk = strstr(line, "SUNK ");
+        for (int s = 0; sunk && s < NUM_SHIPS; ++s) {
+            if (strncmp(sunk + 5, ships[s].name, strlen(ships[s].name)) == 0) {
+                msg->flags |= RESULT_SUNK | (s << RESULT_SHIP_SHIFT);
+                break;
+            }
+        }
+        if (strstr(line, " WIN")) msg->flags |= RESULT_WIN;
+    } else if (strncmp(line, "QUIT", 4) == 0) {
+        msg->type = MSG_QUIT;
+    } else {
+        msg->type = MSG_OTHER;
+    }
+}
+
+/* Take the next whole message (frame or line) out of the reader.
+   Returns 1, 0 if more bytes are needed, or -1 on a bad line. */
+int ReaderNextMessage(LineReader *r, Message *msg) {
+    if (r->head == r->tail) return 0;
+    uint8_t first = (uint8_t)r->buf[r->head & (READER_SIZE - 1)];
+    if (first & 0x80) {
+        if (LineReaderPending(r) < FRAME_SIZE) return 0;
+        uint8_t frame[FRAME_SIZE];
+        for (int i = 0; i < FRAME_SIZE; ++i) {
+            frame[i] = (uint8_t)r->buf[(r->head + (size_t)i) & (READER_SIZE - 1)];
+        }
+        r->head += FRAME_SIZE;
+        if (r->scan < r->head) r->scan = r->head;
+        DecodeFrame(frame, msg);
+        return 1;
+    }
+    LineView line;
+    int got = LineReaderNext(r, &line);
+    if (got <= 0) return got;
+    ParseTextMessage(line.data, msg);
+    msg->size = (int)line.len + 1;
+    return 1;
+}
+
+/* Note what a received message says about the protocol.
+   Returns -1 if a binary frame is out of sequence. */
+int ProtoReceived(ProtoState *p, const Message *msg) {
+    COUNTER_ADD(p->io.msgsIn, 1);
+    COUNTER_ADD(p->io.bytesIn, (uint64_t)msg->size);
+    if (p->metrics) {
+        COUNTER_ADD(p->metrics->io.msgsIn, 1);
+        COUNTER_ADD(p->metrics->io.bytesIn, (uint64_t)msg->size);
+    }
+    if (msg->type == MSG_RESULT && p->shotSentAt) {
+        uint64_t rtt = NowNanos() - p->shotSentAt;
+        p->shotSentAt = 0;
+        p->rttSum += rtt;
+        p->rttCount++;
+        if (rtt > p->rttMax) p->rttMax = rtt;
+        if (p->metrics) LatencyRecord(&p->metrics->rtt, rtt);
+    } else if (msg->type == MSG_SHOT && p->turnFrom) {
+        if (p->metrics) LatencyRecord(&p->metrics->turn, NowNanos() - p->turnFrom);
+        p->turnFrom = 0;
+    }
+
+    if (msg->binary) {
+        if (msg->seq != p->recvSeq) return -1;
+        p->recvSeq++;
+        p->offerSeen = 1; /* a peer that sends frames understands them */
+    } else if (msg->offersBinary) {
+        p->offerSeen = 1;
+    }
+    return 0;
+}
+
+/* Encode one message for this connection into buf (at least LINE_BUF bytes).
+   Returns its length. */
+static int EncodeMessage(ProtoState *p, char *buf, MessageType type, int row, int col, int flags) {
+    if (ProtoBinary(p)) {
+        static const uint8_t typeBytes[] = {
+            [MSG_SHOT] = FRAME_SHOT, [MSG_RESULT] = FRAME_RESULT, [MSG_QUIT] = FRAME_QUIT,
+        };
+        uint8_t *f = (uint8_t *)buf;
+        f[0] = typeBytes[type];
+        f[1] = type == MSG_QUIT ? 0 : (uint8_t)CellIndex(row, col); /* RESULT echoes the cell */
+        f[2] = (uint8_t)flags;
+        f[3] = p->sendSeq++;
+        return FRAME_SIZE;
+    }
+
+    const char *offer = "";
+    if (!p->offerSent && protocolOfferBinary && type != MSG_QUIT) {
+        offer = " BIN";
+        p->offerSent = 1;
+    }
+    switch (type) {
+        case MSG_SHOT:
+            return snprintf(buf, LINE_BUF, "SHOT %d %d%s\n", row, col, offer);
+        case MSG_RESULT:
+            if (flags & RESULT_SUNK) {
+                return snprintf(buf, LINE_BUF, "RESULT HIT SUNK %s%s%s\n", ships[ResultShip(flags)].name,
+                                (flags & RESULT_WIN) ? " WIN" : "", offer);
+            }
+            return snprintf(buf, LINE_BUF, "RESULT %s%s\n",
+                            (flags & RESULT_HIT) ? "HIT" : "MISS", offer);
+        default:
+            return snprintf(buf, LINE_BUF, "QUIT\n");
+    }
+}
+
+/* Encode a message and count it as sent; a SHOT starts the RTT clock */
+int FormatMessage(ProtoState *p, char *buf, MessageType type, int row, int col, int flags) {
+    int n = EncodeMessage(p, buf, type, row, col, flags);
+    COUNTER_ADD(p->io.msgsOut, 1);
+    COUNTER_ADD(p->io.bytesOut, (uint64_t)n);
+    if (p->metrics) {
+        COUNTER_ADD(p->metrics->io.msgsOut, 1);
+        COUNTER_ADD(p->metrics->io.bytesOut, (uint64_t)n);
+    }
+    if (type == MSG_SHOT) p->shotSentAt = p->turnFrom = NowNanos();
+    return n;
+}
+
+/* Count system calls made for this connection */
+static inline void ProtoCountReads(ProtoState *p, uint64_t n) {
+    COUNTER_ADD(p->io.reads, n);
+    if (p->metrics) COUNTER_ADD(p->metrics->io.reads, n);
+}
+
+static inline void ProtoCountSends(ProtoState *p, uint64_t n) {
+    COUNTER_ADD(p->io.sends, n);
+    if (p->metrics) COUNTER_ADD(p->metrics->io.sends, n);
+}
+
+/* Print message and system call totals plus the latency histograms */
+void NetMetricsPrint(const NetMetrics *m) {
+    const NetCounters *io = &m->io;
+    uint64_t msgsOut = COUNTER_GET(io->msgsOut), msgsIn = COUNTER_GET(io->msgsIn);
+    printf("messages out:     %llu (%.1f bytes, %.2f sends each)\n", (unsigned long long)msgsOut,
+           msgsOut ? (double)COUNTER_GET(io->bytesOut) / (double)msgsOut : 0.0,
+           msgsOut ? (double)COUNTER_GET(io->sends) / (double)msgsOut : 0.0);
+    printf("messages in:      %llu (%.1f bytes, %.2f reads each)\n", (unsigned long long)msgsIn,
+           msgsIn ? (double)COUNTER_GET(io->bytesIn) / (double)msgsIn : 0.0,
+           msgsIn ? (double)COUNTER_GET(io->reads) / (double)msgsIn : 0.0);
+    LatencyPrint("shot round trip:", &m->rtt);
+    LatencyPrint("turn:", &m->turn);
+}
+
+/* Send one message on a blocking socket */
+int SendMessage(int sockfd, ProtoState *p, MessageType type, int row, int col, int flags) {
+    char buf[LINE_BUF];
+    int n = FormatMessage(p, buf, type, row, col, flags);
+    int calls = SendAll(sockfd, buf, (size_t)n);
+    if (calls > 0) ProtoCountSends(p, (uint64_t)calls);
+    return calls < 0 ? -1 : 0;
+}
+
+/* Blocking read of the next message. Returns 0 or -1 (closed, error,
+   or a broken frame sequence). */
+int ReceiveMessage(LineReader *r, int sockfd, ProtoState *p, Message *msg) {
+    while (1) {
+        int got = ReaderNextMessage(r, msg);
+        if (got > 0) return ProtoReceived(p, msg);
+        if (got < 0) return -1;
+        ssize_t n = LineReaderFill(r, sockfd);
+        ProtoCountReads(p, 1);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+    }
+}
+
+/* Two-player: shots and replies */
+
+/* Server takes the first shot. */
+
+/* Answer a shot from the other player and tell them what it did.
+   Returns the RESULT_* bits (0 for a miss). */
+int HandleIncomingShotAndRespond(GameState *localGame, int row, int col, int sockfd, ProtoState *proto) {
+    int result = ApplyShotToGrid(&localGame->playerShips, row, col);
+    SendMessage(sockfd, proto, MSG_RESULT, row, col, result);
+    return result;
+}
+
+/* Send a shot at the other player. The RESULT comes back later.
+   Returns 0, -1 if sending failed, or -2 if that cell was already shot. */
+int FireShotAtOpponent(GameState *localGame, int row, int col, int sockfd, ProtoState *proto) {
+    if (GridAlreadyShot(&localGame->playerShots, row, col)) {
+        printf("You already fired at %c%d. Choose a different target.\n", 'A'+row, col);
+        return -2;
+    }
+    if (SendMessage(sockfd, proto, MSG_SHOT, row, col, 0) < 0) { perror("send"); return -1; }
+    return 0;
+}
+
+/* Write the RESULT of our shot into the shot grid and say what happened.
+   Returns its RESULT_* bits. */
+int HandleShotResult(GameState *localGame, int row, int col, const Message *msg) {
+    int hit = (msg->flags & RESULT_HIT) != 0;
+    RecordShot(&localGame->playerShots, row, col, hit);
+    if (msg->flags & RESULT_SUNK) {
+        RecordSunk(&localGame->playerShots, ResultShip(msg->flags), row, col);
+        printf("You sank the opponent's %s at %c%d!\n", ships[ResultShip(msg->flags)].name, 'A'+row, col);
+    } else if (hit) {
+        printf("You hit opponent at %c%d!\n", 'A'+row, col);
+    } else {
+        printf("You missed at %c%d.\n", 'A'+row, col);
+    }
+    return hit ? msg->flags : 0;
+}
+
+/* Two-player main loop */
+
+/*
+ * One poll() loop watches the socket and the keyboard together, so a QUIT
+ * or a dropped connection is seen at once, even while the prompt is up.
+ * Both sides run the same turn state machine; the server just starts in
+ * TURN_MINE. Keyboard lines are only taken while it is our turn, so
+ * anything typed early waits for the next prompt.
+ */
+
+typedef enum {
+    TURN_MINE,         /* prompt is up, waiting for our shot */
+    TURN_WAIT_RESULT,  /* our SHOT is out */
+    TURN_THEIRS,       /* waiting for the opponent's SHOT */
+    TURN_DONE
+} TurnState;
+
+typedef struct {
+    GameState *game;
+    int sockfd;
+    int mySide;          /* 0 for the side that shoots first */
+    TurnState state;
+    int lastRow, lastCol;
+    int stdinOpen;
+    LineReader net;
+    LineReader keys;
+    ProtoState proto;
+    ReplayRecord replay;
+    NetMetrics metrics;
+} TwoPlayerSession;
+
+static void SessionPrompt(TwoPlayerSession *s) {
+    DisplayWorld(s->game);
+    printf("\nYour turn (format A5). Type 'quit' to quit: ");
+    fflush(stdout);
+}
+
+/* A line typed while it is our turn */
+static void SessionInput(TwoPlayerSession *s, const char *input) {
+    if (strcasecmp(input, "quit") == 0) {
+        SendMessage(s->sockfd, &s->proto, MSG_QUIT, 0, 0, 0);
+        printf("You quit. Closing connection.\n");
+        s->state = TURN_DONE;
+        return;
+    }
+    int row, col;
+    int parsed = ParseCell(input, GRID_SIZE, GRID_SIZE, &row, &col);
+    if (parsed == -1) {
+        printf("Invalid input.\n");
+    } else if (parsed == -2) {
+        printf("Coordinates out of range.\n");
+    } else {
+        int res = FireShotAtOpponent(s->game, row, col, s->sockfd, &s->proto);
+        if (res == -1) {
+            s->state = TURN_DONE;
+            return;
+        }
+        if (res == 0) {
+            s->lastRow = row;
+            s->lastCol = col;
+            s->state = TURN_WAIT_RESULT;
+            return;
+        }
+    }
+    printf("\nYour turn (format A5). Type 'quit' to quit: ");
+    fflush(stdout);
+}
+
+/* A message from the opponent, in whatever state we are in */
+static void SessionMessage(TwoPlayerSession *s, const Message *msg) {
+    if (msg->type == MSG_QUIT) {
+        printf("%sOpponent quit. You win.\n", s->state == TURN_MINE ? "\n" : "");
+        s->state = TURN_DONE;
+        return;
+    }
+
+    if (s->state == TURN_WAIT_RESULT && msg->type == MSG_RESULT) {
+        int res = HandleShotResult(s->game, s->lastRow, s->lastCol, msg);
+        ReplayAddShot(&s->replay, s->lastRow, s->lastCol);
+        if (res & RESULT_WIN) {
+            printf("All opponent ships destroyed. You win!\n");
+            ReplaySetWinner(&s->replay, s->mySide);
+            s->state = TURN_DONE;
+            return;
+        }
+        s->state = TURN_THEIRS;
+        return;
+    }
+
+    if (s->state == TURN_THEIRS && msg->type == MSG_SHOT) {
+        int r = msg->row, c = msg->col;
+        if (r < 0 || r >= GRID_SIZE || c < 0 || c >= GRID_SIZE) {
+            printf("Malformed SHOT received.\n");
+            s->state = TURN_DONE;
+            return;
+        }
+        int result = HandleIncomingShotAndRespond(s->game, r, c, s->sockfd, &s->proto);
+        ReplayAddShot(&s->replay, r, c);
+        if (result & RESULT_SUNK) printf("Opponent sank your %s at %c%d.\n", ships[ResultShip(result)].name, 'A'+r, c);
+        else if (result)          printf("Opponent hit you at %c%d.\n", 'A'+r, c);
+        else                      printf("Opponent missed at %c%d.\n", 'A'+r, c);
+        if (GridAllShipsDestroyed(&s->game->playerShips)) {
+            printf("All your ships destroyed. You lose.\n");
+            ReplaySetWinner(&s->replay, 1 - s->mySide);
+            s->state = TURN_DONE;
+            return;
+        }
+        s->state = TURN_MINE;
+        SessionPrompt(s);
+        return;
+    }
+
+    printf("%sUnexpected message from opponent: %s\n", s->state == TURN_MINE ? "\n" : "", msg->text);
+    s->state = TURN_DONE;
+}
+
+/* Play two-player game on this socket.
+   If amServer is 1, this side shoots first. seed is what our fleet was
+   drawn from; the replay keeps it so the game can be played back. */
+void PlayTwoPlayer(GameState *localGame, int sockfd, int amServer, uint64_t seed) {
+    static TwoPlayerSession s; /* big histograms: keep them off the stack */
+    s.game = localGame;
+    s.sockfd = sockfd;
+    s.mySide = amServer ? 0 : 1; /* side 0 shoots first in the replay */
+    s.state = amServer ? TURN_MINE : TURN_THEIRS;
+    s.stdinOpen = 1;
+    LineReaderInit(&s.net);
+    LineReaderInit(&s.keys);
+    ProtoInit(&s.proto);
+    memset(&s.metrics, 0, sizeof(s.metrics));
+    s.proto.metrics = &s.metrics;
+    /* RESULT and our next SHOT are separate writes: without this, Nagle
+       holds the SHOT back until the peer's delayed ACK (about 40 ms) */
+    int one = 1;
+    setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    ReplayBegin(&s.replay, seed, REPLAY_TWO_PLAYER);
+    ReplaySetFleet(&s.replay, s.mySide, &localGame->playerShips);
+
+    printf("Two-player game started. Type 'quit' to leave and send QUIT.\n");
+    if (amServer) printf("You are server: you shoot first.\n");
+    else          printf("You are client: opponent shoots first.\n");
+    if (s.state == TURN_MINE) SessionPrompt(&s);
+    else                      DisplayWorld(localGame);
+
+    while (s.state != TURN_DONE) {
+        /* Messages and lines already buffered go first */
+        Message msg;
+        int got = ReaderNextMessage(&s.net, &msg);
+        if (got > 0) {
+            if (ProtoReceived(&s.proto, &msg) < 0) {
+                printf("Broken message sequence from opponent.\n");
+                break;
+            }
+            SessionMessage(&s, &msg);
+            continue;
+        }
+        if (got < 0) {
+            printf("Malformed message from opponent.\n");
+            break;
+        }
+        if (s.state == TURN_MINE) {
+            LineView line;
+            int typed = LineReaderNext(&s.keys, &line);
+            if (typed > 0) {
+                SessionInput(&s, line.data);
+                continue;
+            }
+            if (typed < 0) {
+                LineReaderInit(&s.keys); /* line too long: drop it */
+                SessionInput(&s, "");
+                continue;
+            }
+            if (!s.stdinOpen) {
+                printf("stdin closed.\n");
+                break;
+            }
+        }
+
+        struct pollfd fds[2];
+        fds[0].fd = sockfd;
+        fds[0].events = POLLIN;
+        fds[1].fd = STDIN_FILENO;
+        fds[1].events = POLLIN;
+        int nfds = s.state == TURN_MINE ? 2 : 1;
+        if (poll(fds, (nfds_t)nfds, -1) < 0) {
+            if (errno == EINTR) continue;
+            perror("poll");
+            break;
+        }
+        if (fds[0].revents & (POLLIN | POLLERR | POLLHUP)) {
+            ssize_t n = LineReaderFill(&s.net, sockfd);
+            ProtoCountReads(&s.proto, 1);
+            if (n == 0 || (n < 0 && errno != EINTR)) {
+                printf("%sConnection closed by opponent.\n", s.state == TURN_MINE ? "\n" : "");
+                break;
+            }
+        }
+        if (nfds == 2 && (fds[1].revents & (POLLIN | POLLERR | POLLHUP))) {
+            ssize_t n = LineReaderFill(&s.keys, STDIN_FILENO);
+            if (n == 0 || (n < 0 && errno != EINTR)) s.stdinOpen = 0;
+        }
+    }
+
+    ReplayAppend(&replayWriter, &s.replay);
+    close(sockfd);
+    printf("Two-player session ended.\n");
+    NetMetricsPrint(&s.metrics);
+}
+
+/* Server and client setup */
+
+/* Open a TCP socket listening on port. With reusePort several sockets
+   can listen on the same port and the kernel spreads connections over
+   them. Returns the fd or -1. */
+int OpenListener(int port, int backlog, int reusePort) {
+    int listenfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listenfd < 0) { perror("socket"); return -1; }
+
+    int opt = 1;
+    if (setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
+        perror("setsockopt");
+    }
+    if (reusePort && setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+        perror("setsockopt SO_REUSEPORT");
+        close(listenfd);
+        return -1;
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = INADDR_ANY;
+
+    if (bind(listenfd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("bind");
+        close(listenfd);
+        return -1;
+    }
+
+    if (listen(listenfd, backlog) < 0) {
+        perror("listen");
+        close(listenfd);
+        return -1;
+    }
+    return listenfd;
+}
+
+/* Run as server: open port, accept one player, then start game.
+   seed is the one gameRng was seeded with. */
+int RunServerMode(int port, uint64_t seed) {
+    int listenfd = OpenListener(port, 1, 0);
+    if (listenfd < 0) return -1;
 
     printf("Server listening on port %d. Waiting for a client...\n", port);
     int clientfd = accept(listenfd, NULL, NULL);
@@ -445,84 +4209,2487 @@ int RunServerMode(int port) {
         close(listenfd);
         return -1;
     }
-    close(listenfd);
-    printf("Client connected.\n");
+    close(listenfd);
+    printf("Client connected.\n");
+
+    GameState *localGame = SetupSinglePlayer(&gameRng);
+
+    PlayTwoPlayer(localGame, clientfd, 1, seed); /* server shoots first */
+
+    TeardownSinglePlayer(localGame);
+    return 0;
+}
+
+/* Run as client: connect to given ip:port and start game.
+   seed is the one gameRng was seeded with. */
+int RunClientMode(const char *ip, int port, uint64_t seed) {
+    int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (sockfd < 0) { perror("socket"); return -1; }
+
+    struct sockaddr_in servaddr;
+    memset(&servaddr, 0, sizeof(servaddr));
+    servaddr.sin_family = AF_INET;
+    servaddr.sin_port = htons(port);
+    if (inet_pton(AF_INET, ip, &servaddr.sin_addr) <= 0) {
+        fprintf(stderr, "Invalid IP address: %s\n", ip);
+        close(sockfd);
+        return -1;
+    }
+
+    printf("Connecting to %s:%d ...\n", ip, port);
+    if (connect(sockfd, (struct sockaddr*)&servaddr, sizeof(servaddr)) < 0) {
+        perror("connect");
+        close(sockfd);
+        return -1;
+    }
+    printf("Connected to server.\n");
+
+    GameState *localGame = SetupSinglePlayer(&gameRng);
+
+    PlayTwoPlayer(localGame, sockfd, 0, seed); /* client waits first, then shoots */
+
+    TeardownSinglePlayer(localGame);
+    return 0;
+}
+
+/* io_uring rings */
+
+/*
+ * A minimal io_uring driver on the raw system calls, for the server's
+ * --io uring backend. Requests are queued in the submission ring and all
+ * of them go to the kernel with the next wait, so one io_uring_enter()
+ * submits a whole batch and collects the completions of the previous one.
+ * Received data lands in a provided buffer ring registered with the
+ * kernel: a multishot recv picks a free buffer for every chunk it
+ * delivers, and we hand the buffer back once its bytes are copied out.
+ */
+
+#define RING_ENTRIES 4096
+#define RING_BUFS 4096          /* provided receive buffers, power of two */
+#define RING_BUF_SIZE 256
+#define RING_BUF_GROUP 0
+
+typedef struct {
+    int fd;
+    unsigned *sqHead, *sqTail, *sqMask;
+    unsigned *cqHead, *cqTail, *cqMask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    unsigned sqEntries;
+    unsigned sqLocal;          /* our tail, published on submit */
+    void *sqMap, *cqMap;
+    size_t sqMapSize, cqMapSize, sqesSize;
+    struct io_uring_buf_ring *bufRing;
+    size_t bufRingSize;
+    char *bufs;
+    unsigned short bufTail;
+    long enters;               /* io_uring_enter() calls */
+} IoRing;
+
+static inline int RingSetupCall(unsigned entries, struct io_uring_params *p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static inline int RingEnterCall(int fd, unsigned submit, unsigned wait, unsigned flags,
+                                void *arg, size_t argSize) {
+    return (int)syscall(__NR_io_uring_enter, fd, submit, wait, flags, arg, argSize);
+}
+
+void RingDestroy(IoRing *r) {
+    if (r->bufRing) munmap(r->bufRing, r->bufRingSize);
+    free(r->bufs);
+    if (r->sqes) munmap(r->sqes, r->sqesSize);
+    if (r->cqMap && r->cqMap != r->sqMap) munmap(r->cqMap, r->cqMapSize);
+    if (r->sqMap) munmap(r->sqMap, r->sqMapSize);
+    if (r->fd >= 0) close(r->fd);
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
+}
+
+/* Register the receive buffers as a provided buffer ring */
+static int RingSetupBuffers(IoRing *r) {
+    r->bufRingSize = RING_BUFS * sizeof(struct io_uring_buf);
+    r->bufRing = mmap(NULL, r->bufRingSize, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (r->bufRing == MAP_FAILED) { r->bufRing = NULL; return -1; }
+    r->bufs = malloc((size_t)RING_BUFS * RING_BUF_SIZE);
+    if (!r->bufs) return -1;
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)r->bufRing;
+    reg.ring_entries = RING_BUFS;
+    reg.bgid = RING_BUF_GROUP;
+    if (syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) return -1;
+
+    for (unsigned short b = 0; b < RING_BUFS; ++b) {
+        struct io_uring_buf *buf = &r->bufRing->bufs[b];
+        buf->addr = (uint64_t)(uintptr_t)(r->bufs + (size_t)b * RING_BUF_SIZE);
+        buf->len = RING_BUF_SIZE;
+        buf->bid = b;
+    }
+    r->bufTail = RING_BUFS;
+    __atomic_store_n(&r->bufRing->tail, r->bufTail, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/* Set up a ring with its receive buffers. Returns -1 (errno set) if this
+   kernel cannot, so the caller can fall back to epoll. */
+int RingInit(IoRing *r) {
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
+    /* Newer kernels run completions only when we ask for them; older ones
+       reject those flags, so try with fewer */
+    static const unsigned tries[] = {
+        IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN,
+        IORING_SETUP_COOP_TASKRUN,
+        0
+    };
+    struct io_uring_params p;
+    for (size_t i = 0; i < sizeof(tries) / sizeof(tries[0]) && r->fd < 0; ++i) {
+        memset(&p, 0, sizeof(p));
+        p.flags = tries[i] | IORING_SETUP_CQSIZE;
+        p.cq_entries = RING_ENTRIES * 4;
+        r->fd = RingSetupCall(RING_ENTRIES, &p);
+    }
+    if (r->fd < 0) return -1;
+    if (!(p.features & IORING_FEAT_EXT_ARG)) { RingDestroy(r); errno = ENOSYS; return -1; }
+
+    r->sqMapSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cqMapSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (r->cqMapSize > r->sqMapSize) r->sqMapSize = r->cqMapSize;
+        r->cqMapSize = r->sqMapSize;
+    }
+    r->sqMap = mmap(NULL, r->sqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    r->fd, IORING_OFF_SQ_RING);
+    if (r->sqMap == MAP_FAILED) { r->sqMap = NULL; goto fail; }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        r->cqMap = r->sqMap;
+    } else {
+        r->cqMap = mmap(NULL, r->cqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        r->fd, IORING_OFF_CQ_RING);
+        if (r->cqMap == MAP_FAILED) { r->cqMap = NULL; goto fail; }
+    }
+    r->sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) { r->sqes = NULL; goto fail; }
+
+    char *sq = r->sqMap, *cq = r->cqMap;
+    r->sqHead = (unsigned *)(sq + p.sq_off.head);
+    r->sqTail = (unsigned *)(sq + p.sq_off.tail);
+    r->sqMask = (unsigned *)(sq + p.sq_off.ring_mask);
+    r->sqEntries = p.sq_entries;
+    r->cqHead = (unsigned *)(cq + p.cq_off.head);
+    r->cqTail = (unsigned *)(cq + p.cq_off.tail);
+    r->cqMask = (unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    /* Slot i of the submission array always names entry i */
+    unsigned *array = (unsigned *)(sq + p.sq_off.array);
+    for (unsigned i = 0; i < p.sq_entries; ++i) array[i] = i;
+    r->sqLocal = *r->sqTail;
+
+    if (RingSetupBuffers(r) < 0) goto fail;
+    return 0;
+
+fail:
+    {
+        int err = errno;
+        RingDestroy(r);
+        errno = err;
+    }
+    return -1;
+}
+
+/* Submit what is queued and wait up to timeoutMs for at least one
+   completion (0 = do not wait). Returns 0, or -1 with errno (ETIME when
+   the time ran out). */
+int RingSubmitAndWait(IoRing *r, int timeoutMs) {
+    __atomic_store_n(r->sqTail, r->sqLocal, __ATOMIC_RELEASE);
+    struct __kernel_timespec ts = { timeoutMs / 1000, (long long)(timeoutMs % 1000) * 1000000 };
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.ts = (uint64_t)(uintptr_t)&ts;
+    unsigned flags = IORING_ENTER_EXT_ARG | (timeoutMs ? IORING_ENTER_GETEVENTS : 0);
+    unsigned queued = r->sqLocal - __atomic_load_n(r->sqHead, __ATOMIC_ACQUIRE);
+    int n = RingEnterCall(r->fd, queued, timeoutMs ? 1 : 0, flags, &arg, sizeof(arg));
+    r->enters++;
+    return n < 0 ? -1 : 0;
+}
+
+/* Next free submission entry, cleared. Submits the queue first if it is full. */
+struct io_uring_sqe *RingGetSqe(IoRing *r) {
+    unsigned head = __atomic_load_n(r->sqHead, __ATOMIC_ACQUIRE);
+    if (r->sqLocal - head >= r->sqEntries) {
+        RingSubmitAndWait(r, 0);
+        head = __atomic_load_n(r->sqHead, __ATOMIC_ACQUIRE);
+        if (r->sqLocal - head >= r->sqEntries) return NULL;
+    }
+    struct io_uring_sqe *sqe = &r->sqes[r->sqLocal & *r->sqMask];
+    memset(sqe, 0, sizeof(*sqe));
+    r->sqLocal++;
+    return sqe;
+}
+
+/* Give a receive buffer back to the kernel */
+static inline void RingReturnBuffer(IoRing *r, unsigned short bid) {
+    struct io_uring_buf *buf = &r->bufRing->bufs[r->bufTail & (RING_BUFS - 1)];
+    buf->addr = (uint64_t)(uintptr_t)(r->bufs + (size_t)bid * RING_BUF_SIZE);
+    buf->len = RING_BUF_SIZE;
+    buf->bid = bid;
+    r->bufTail++;
+    __atomic_store_n(&r->bufRing->tail, r->bufTail, __ATOMIC_RELEASE);
+}
+
+static inline const char *RingBuffer(const IoRing *r, unsigned short bid) {
+    return r->bufs + (size_t)bid * RING_BUF_SIZE;
+}
+
+/* Event-driven match server */
+
+/*
+ * --serve runs many matches in one process. Every client that connects
+ * plays against the computer using the same text protocol as PlayTwoPlayer
+ * (the server shoots first), so the normal client works unchanged.
+ * Each event loop (epoll, or io_uring with --io uring) drives its share of
+ * the matches; each match is a small state machine that only moves when a
+ * line arrives.
+ */
+
+#define MATCH_OUTBUF 256
+#define MAX_EVENTS 256
+
+typedef enum {
+    MATCH_WAIT_RESULT, /* we sent SHOT and wait for RESULT */
+    MATCH_WAIT_SHOT,   /* we wait for the client's SHOT */
+    MATCH_CLOSING      /* send what is left, then close */
+} MatchState;
+
+/* One connected client and the computer's side of its game */
+typedef struct {
+    int fd;
+    MatchState state;
+    GameState game;    /* computer's ships, and its shots at the client */
+    Rng rng;
+    int lastRow, lastCol;
+    ReplayRecord replay; /* the computer is side 0 */
+    LineReader in;
+    ProtoState proto;
+    size_t outLen, outSent;
+    uint32_t events;   /* epoll backend: events registered for fd */
+    /* io_uring backend: requests the kernel still holds for this match */
+    int inflight;
+    uint8_t recving, sending, closing;
+    char out[MATCH_OUTBUF];
+} Match;
+
+/* Counters printed when the server stops */
+typedef struct {
+    _Atomic long active;
+    _Atomic long accepted;
+    _Atomic long closed;
+    _Atomic long finished;
+    _Atomic long errors;
+    _Atomic long malformed;    /* messages the protocol does not allow here */
+    _Atomic long syscalls;     /* made by the event loop, of every kind */
+} ServerStats;
+
+/* Everything one event loop counts. Only the loop's own thread writes its
+   copy, with COUNTER_ADD; whoever reads the counters (SIGUSR1, the
+   metrics page) adds all copies together with COUNTER_GET. */
+typedef struct {
+    ServerStats stats;
+    NetMetrics net;
+} LoopCounters;
+
+#define MAX_LOOPS 256
+static LoopCounters *loopCounters[MAX_LOOPS];
+static atomic_int loopCount;
+static _Thread_local LoopCounters *counters; /* the calling thread's loop */
+
+/* Give the calling thread its own counters. Returns NULL if there are
+   already MAX_LOOPS. */
+LoopCounters *RegisterLoopCounters(void) {
+    int i = atomic_fetch_add(&loopCount, 1);
+    if (i >= MAX_LOOPS) return NULL;
+    LoopCounters *c = calloc(1, sizeof(*c));
+    if (!c) return NULL;
+    loopCounters[i] = c;
+    counters = c;
+    return c;
+}
+
+/* Free every loop's counters once no loop or reader is left */
+void ReleaseLoopCounters(void) {
+    int n = atomic_load(&loopCount);
+    for (int i = 0; i < n && i < MAX_LOOPS; ++i) {
+        free(loopCounters[i]);
+        loopCounters[i] = NULL;
+    }
+    atomic_store(&loopCount, 0);
+}
+
+/* Add up the counters of every loop. The result can be a few events
+   behind a loop that is busy while it is read. */
+void MergeLoopCounters(LoopCounters *out) {
+    memset(out, 0, sizeof(*out));
+    int n = atomic_load(&loopCount);
+    if (n > MAX_LOOPS) n = MAX_LOOPS;
+    for (int i = 0; i < n; ++i) {
+        const LoopCounters *c = loopCounters[i];
+        if (!c) continue;
+        COUNTER_ADD(out->stats.active,    COUNTER_GET(c->stats.active));
+        COUNTER_ADD(out->stats.accepted,  COUNTER_GET(c->stats.accepted));
+        COUNTER_ADD(out->stats.closed,    COUNTER_GET(c->stats.closed));
+        COUNTER_ADD(out->stats.finished,  COUNTER_GET(c->stats.finished));
+        COUNTER_ADD(out->stats.errors,    COUNTER_GET(c->stats.errors));
+        COUNTER_ADD(out->stats.malformed, COUNTER_GET(c->stats.malformed));
+        COUNTER_ADD(out->stats.syscalls,  COUNTER_GET(c->stats.syscalls));
+        COUNTER_ADD(out->net.io.msgsIn,   COUNTER_GET(c->net.io.msgsIn));
+        COUNTER_ADD(out->net.io.msgsOut,  COUNTER_GET(c->net.io.msgsOut));
+        COUNTER_ADD(out->net.io.bytesIn,  COUNTER_GET(c->net.io.bytesIn));
+        COUNTER_ADD(out->net.io.bytesOut, COUNTER_GET(c->net.io.bytesOut));
+        COUNTER_ADD(out->net.io.reads,    COUNTER_GET(c->net.io.reads));
+        COUNTER_ADD(out->net.io.sends,    COUNTER_GET(c->net.io.sends));
+        LatencyMerge(&out->net.rtt, &c->net.rtt);
+        LatencyMerge(&out->net.turn, &c->net.turn);
+    }
+}
+
+/* --match-log: one line per match when it closes */
+static int serverMatchLog = 0;
+
+/* SIGUSR1 asks for a dump of the live counters. The handler runs on
+   whichever thread gets the signal and the loops read the flag, so it is
+   a (lock-free) atomic rather than a sig_atomic_t. */
+static atomic_int dumpServerStats;
+
+static void HandleDumpSignal(int sig) {
+    (void)sig;
+    dumpServerStats = 1;
+}
+
+void PrintServerStats(void) {
+    static LoopCounters all;
+    MergeLoopCounters(&all);
+    printf("accepted=%ld active=%ld finished=%ld errors=%ld malformed=%ld\n",
+           COUNTER_GET(all.stats.accepted), COUNTER_GET(all.stats.active),
+           COUNTER_GET(all.stats.finished), COUNTER_GET(all.stats.errors),
+           COUNTER_GET(all.stats.malformed));
+    NetMetricsPrint(&all.net);
+    fflush(stdout);
+}
+
+/* Match slots are recycled, so accepting and closing clients does not
+   touch the heap once the pool has grown to the peak number of matches */
+#define MATCH_POOL_CHUNK 256
+
+/*
+ * The server runs one event loop thread per shard (by default one per
+ * core). Every shard has its own listening socket on the same port
+ * (SO_REUSEPORT), so the kernel spreads new connections over them and no
+ * connection is ever passed between threads. A match lives on the shard
+ * that accepted it from its first message to its last, and everything it
+ * touches (pool slot, random generator, replay buffer, counters) belongs
+ * to that shard, so nothing on the turn path takes a lock.
+ * With --io uring a shard drives its sockets through an io_uring instead
+ * of epoll; a kernel without the needed io_uring features gets epoll.
+ */
+typedef struct {
+    _Alignas(64) int id;  /* keep shards on separate cache lines */
+    int listenfd;
+    int epfd;
+    Pool pool;            /* Match slots */
+    Rng rng;              /* seeds for new matches */
+    ReplayWriter replay;
+    LoopCounters *counters;
+    unsigned long allocs; /* heap allocations made by the shard's thread */
+    int uring;            /* runs on ring below instead of epfd */
+    IoRing ring;
+    pthread_t thread;
+} Shard;
+
+/* --io: how the shards wait for sockets */
+typedef enum {
+    IO_EPOLL,
+    IO_URING
+} IoBackend;
+
+static IoBackend serverIo = IO_EPOLL;
+
+static atomic_int stopServer;       /* set from signal handlers, read by every loop */
+static atomic_int serverReady;      /* every shard is running */
+static LoopCounters serverTotals;   /* of the last server run, once it stopped */
+
+static void HandleStopSignal(int sig) {
+    (void)sig;
+    stopServer = 1;
+}
+
+/* Total number of ship cells in the fleet */
+int FleetCells(void) {
+    int total = 0;
+    for (int s = 0; s < NUM_SHIPS; ++s) total += ships[s].size;
+    return total;
+}
+
+/* Make a socket non-blocking */
+int SetNonBlocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0) return -1;
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+/* Allow as many open sockets as the hard limit permits */
+void RaiseFileLimit(void) {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+}
+
+/* Save the replay and count the match as closed; both backends */
+void MatchFinish(Shard *sh, Match *m) {
+    ReplayAppend(&sh->replay, &m->replay);
+    if (serverMatchLog) {
+        const ProtoState *p = &m->proto;
+        fprintf(stderr, "match fd=%d shots=%d msgs=%llu/%llu bytes=%llu/%llu syscalls=%llu/%llu rtt mean=%.1fus max=%.1fus\n",
+                m->fd, m->replay.shots,
+                (unsigned long long)COUNTER_GET(p->io.msgsIn), (unsigned long long)COUNTER_GET(p->io.msgsOut),
+                (unsigned long long)COUNTER_GET(p->io.bytesIn), (unsigned long long)COUNTER_GET(p->io.bytesOut),
+                (unsigned long long)COUNTER_GET(p->io.reads), (unsigned long long)COUNTER_GET(p->io.sends),
+                p->rttCount ? (double)p->rttSum / p->rttCount / 1e3 : 0.0, (double)p->rttMax / 1e3);
+    }
+    COUNTER_ADD(counters->stats.active, -1);
+    COUNTER_ADD(counters->stats.closed, 1);
+}
+
+/* Close a match and give its slot back to the shard's pool */
+void MatchClose(Shard *sh, Match *m) {
+    MatchFinish(sh, m);
+    epoll_ctl(sh->epfd, EPOLL_CTL_DEL, m->fd, NULL);
+    close(m->fd);
+    COUNTER_ADD(counters->stats.syscalls, 2);
+    PoolRelease(&sh->pool, m);
+}
+
+/* Add one message to the match's output buffer */
+int MatchQueue(Match *m, MessageType type, int row, int col, int flags) {
+    if (sizeof(m->out) - m->outLen < LINE_BUF) return -1;
+    m->outLen += (size_t)FormatMessage(&m->proto, m->out + m->outLen, type, row, col, flags);
+    return 0;
+}
+
+/* Send as much queued output as the socket takes.
+   Returns 1 if everything went out, 0 if some is left, -1 on error. */
+int MatchFlush(Match *m, int epfd) {
+    while (m->outSent < m->outLen) {
+        ssize_t n = send(m->fd, m->out + m->outSent, m->outLen - m->outSent, MSG_NOSIGNAL);
+        ProtoCountSends(&m->proto, 1);
+        COUNTER_ADD(counters->stats.syscalls, 1);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        m->outSent += (size_t)n;
+    }
+
+    int done = m->outSent == m->outLen;
+    if (done) {
+        m->outSent = m->outLen = 0;
+    }
+    /* Only ask for EPOLLOUT while something is waiting to go out, and
+       only tell epoll when that changes */
+    uint32_t want = done ? EPOLLIN : (EPOLLIN | EPOLLOUT);
+    if (want != m->events) {
+        struct epoll_event ev;
+        ev.events = want;
+        ev.data.ptr = m;
+        epoll_ctl(epfd, EPOLL_CTL_MOD, m->fd, &ev);
+        COUNTER_ADD(counters->stats.syscalls, 1);
+        m->events = want;
+    }
+    return done;
+}
+
+/* Computer picks a target and sends SHOT */
+int MatchSendShot(Match *m) {
+    ComputerPickShot(&m->game.playerShots, &m->rng, &m->lastRow, &m->lastCol);
+    m->state = MATCH_WAIT_RESULT;
+    return MatchQueue(m, MSG_SHOT, m->lastRow, m->lastCol, 0);
+}
+
+/* Count a message the protocol does not allow. Returns -1 to drop the match. */
+static int MatchMalformed(void) {
+    COUNTER_ADD(counters->stats.malformed, 1);
+    return -1;
+}
+
+/* Handle one message from the client. Returns -1 to drop the match. */
+int MatchHandleMessage(Match *m, const Message *msg) {
+    if (ProtoReceived(&m->proto, msg) < 0) return MatchMalformed();
+    if (msg->type == MSG_QUIT) return -1;
+
+    if (m->state == MATCH_WAIT_RESULT) {
+        if (msg->type != MSG_RESULT) return MatchMalformed();
+        int hit = (msg->flags & RESULT_HIT) != 0;
+        RecordShot(&m->game.playerShots, m->lastRow, m->lastCol, hit);
+        if (hit && (msg->flags & RESULT_SUNK)) {
+            RecordSunk(&m->game.playerShots, ResultShip(msg->flags), m->lastRow, m->lastCol);
+        }
+        ReplayAddShot(&m->replay, m->lastRow, m->lastCol);
+        if ((msg->flags & RESULT_WIN) || BitboardCount(m->game.playerShots.hits) == FleetCells()) {
+            ReplaySetWinner(&m->replay, 0);
+            /* Client is out of ships; it closes the connection itself */
+            m->state = MATCH_CLOSING;
+            return 0;
+        }
+        m->state = MATCH_WAIT_SHOT;
+        return 0;
+    }
+
+    if (m->state == MATCH_WAIT_SHOT) {
+        int r = msg->row, c = msg->col;
+        if (msg->type != MSG_SHOT) return MatchMalformed();
+        if (r < 0 || r >= GRID_SIZE || c < 0 || c >= GRID_SIZE) return MatchMalformed();
+        int result = ApplyShotToGrid(&m->game.playerShips, r, c);
+        ReplayAddShot(&m->replay, r, c);
+        if (MatchQueue(m, MSG_RESULT, r, c, result) < 0) return -1;
+        if (result & RESULT_WIN) {
+            ReplaySetWinner(&m->replay, 1);
+            /* Client won: QUIT tells it the game is over */
+            m->state = MATCH_CLOSING;
+            return MatchQueue(m, MSG_QUIT, 0, 0, 0);
+        }
+        return MatchSendShot(m);
+    }
+
+    return MatchMalformed(); /* nothing more is expected while closing */
+}
+
+/* Run every complete message in the match's reader.
+   Returns -1 when the match should be closed. */
+int MatchProcess(Match *m) {
+    Message msg;
+    int got;
+    while ((got = ReaderNextMessage(&m->in, &msg)) > 0) {
+        if (MatchHandleMessage(m, &msg) < 0) return -1;
+    }
+    if (got < 0) return MatchMalformed(); /* line too long */
+    return 0;
+}
+
+/* Read what is available and run every complete message.
+   Returns -1 when the match should be closed. */
+int MatchRead(Match *m) {
+    while (1) {
+        ssize_t n = LineReaderFill(&m->in, m->fd);
+        ProtoCountReads(&m->proto, 1);
+        COUNTER_ADD(counters->stats.syscalls, 1);
+        if (n == 0) return -1;
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (MatchProcess(m) < 0) return -1;
+    }
+    return 0;
+}
+
+/* Set up a new match on an accepted socket: the computer's fleet, the
+   protocol state and the replay record */
+void MatchInit(Shard *sh, Match *m, int fd) {
+    m->fd = fd;
+    LineReaderInit(&m->in);
+    ProtoInit(&m->proto);
+    m->proto.metrics = &counters->net;
+    uint64_t seed = RngNext(&sh->rng);
+    RngSeed(&m->rng, seed);
+    InitGame(&m->game, &m->rng);
+    ReplayBegin(&m->replay, seed, REPLAY_SERVER);
+    ReplaySetFleet(&m->replay, 0, &m->game.playerShips);
+}
+
+/* Accept every client waiting on the shard's listener and start a match for each */
+void AcceptMatches(Shard *sh) {
+    while (1) {
+        int fd = accept(sh->listenfd, NULL, NULL);
+        COUNTER_ADD(counters->stats.syscalls, 1);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) perror("accept");
+            return;
+        }
+        Match *m = PoolAcquire(&sh->pool);
+        COUNTER_ADD(counters->stats.syscalls, 2); /* fcntl get and set */
+        if (!m || SetNonBlocking(fd) < 0) {
+            PoolRelease(&sh->pool, m);
+            close(fd);
+            COUNTER_ADD(counters->stats.errors, 1);
+            continue;
+        }
+        MatchInit(sh, m, fd);
+
+        struct epoll_event ev;
+        ev.events = m->events = EPOLLIN;
+        ev.data.ptr = m;
+        COUNTER_ADD(counters->stats.syscalls, 1);
+        if (epoll_ctl(sh->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            perror("epoll_ctl");
+            close(fd);
+            PoolRelease(&sh->pool, m);
+            COUNTER_ADD(counters->stats.errors, 1);
+            continue;
+        }
+        COUNTER_ADD(counters->stats.active, 1);
+        COUNTER_ADD(counters->stats.accepted, 1);
+
+        /* Server shoots first */
+        if (MatchSendShot(m) < 0 || MatchFlush(m, sh->epfd) < 0) {
+            COUNTER_ADD(counters->stats.errors, 1);
+            MatchClose(sh, m);
+        }
+    }
+}
+
+/* Metrics */
+
+/*
+ * --metrics-port serves the server's counters as a Prometheus text page
+ * over HTTP, and --metrics-file rewrites the same page into a file once a
+ * second (through a temporary file and rename, so readers never see half
+ * of it). Both run on a thread of their own that reads the loops'
+ * counters; the event loops only bump their own counters and never wait
+ * for it.
+ */
+
+#define METRICS_INTERVAL_NS 1000000000ULL
+
+typedef struct {
+    int port;           /* --metrics-port, 0 = off */
+    const char *path;   /* --metrics-file, NULL = off */
+    const Shard *shards; /* their listeners, for the accept queues */
+    int shardCount;
+    int listenfd;       /* metrics HTTP listener, -1 if none */
+    uint64_t lastAt;    /* when the rates below were taken */
+    uint64_t lastIn, lastOut;
+    double inRate, outRate;
+} MetricsServer;
+
+static MetricsServer metricsServer = { 0, NULL, NULL, 0, -1, 0, 0, 0, 0.0, 0.0 };
+
+/* Write one counter or gauge with its HELP and TYPE lines */
+static void MetricsValue(FILE *f, const char *name, const char *type, const char *help,
+                         double value) {
+    fprintf(f, "# HELP %s %s\n# TYPE %s %s\n%s %.12g\n", name, help, name, type, name, value);
+}
+
+/* Write a latency histogram as a summary in seconds */
+static void MetricsSummary(FILE *f, const char *name, const char *help,
+                           const LatencyHistogram *h) {
+    static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+    fprintf(f, "# HELP %s %s\n# TYPE %s summary\n", name, help, name);
+    for (size_t i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); ++i) {
+        fprintf(f, "%s{quantile=\"%g\"} %.9f\n", name, quantiles[i],
+                (double)LatencyPercentile(h, quantiles[i]) / 1e9);
+    }
+    fprintf(f, "%s_sum %.9f\n%s_count %llu\n", name, (double)COUNTER_GET(h->sum) / 1e9, name,
+            (unsigned long long)COUNTER_GET(h->total));
+}
+
+/* Write the whole metrics page */
+void MetricsWrite(MetricsServer *ms, FILE *f) {
+    static LoopCounters all;
+    MergeLoopCounters(&all);
+
+    /* For a listening socket the kernel reports the accept queue in
+       tcpi_unacked and its limit in tcpi_sacked */
+    double queued = 0, queueLimit = 0;
+    for (int i = 0; i < ms->shardCount; ++i) {
+        struct tcp_info ti;
+        socklen_t len = sizeof(ti);
+        memset(&ti, 0, sizeof(ti));
+        if (getsockopt(ms->shards[i].listenfd, IPPROTO_TCP, TCP_INFO, &ti, &len) < 0) continue;
+        queued += ti.tcpi_unacked;
+        queueLimit += ti.tcpi_sacked;
+    }
+
+    MetricsValue(f, "battleship_matches_active", "gauge", "Matches in progress.",
+                 (double)COUNTER_GET(all.stats.active));
+    MetricsValue(f, "battleship_connections_accepted_total", "counter",
+                 "Connections accepted as matches.", (double)COUNTER_GET(all.stats.accepted));
+    MetricsValue(f, "battleship_connections_closed_total", "counter",
+                 "Match connections closed.", (double)COUNTER_GET(all.stats.closed));
+    MetricsValue(f, "battleship_matches_finished_total", "counter",
+                 "Matches played to the end.", (double)COUNTER_GET(all.stats.finished));
+    MetricsValue(f, "battleship_matches_failed_total", "counter",
+                 "Matches dropped on an error or disconnect.", (double)COUNTER_GET(all.stats.errors));
+    MetricsValue(f, "battleship_messages_malformed_total", "counter",
+                 "Messages the protocol does not allow.", (double)COUNTER_GET(all.stats.malformed));
+    MetricsValue(f, "battleship_messages_in_total", "counter", "Messages received.",
+                 (double)COUNTER_GET(all.net.io.msgsIn));
+    MetricsValue(f, "battleship_messages_out_total", "counter", "Messages sent.",
+                 (double)COUNTER_GET(all.net.io.msgsOut));
+    MetricsValue(f, "battleship_messages_in_per_second", "gauge",
+                 "Messages received per second over the last interval.", ms->inRate);
+    MetricsValue(f, "battleship_messages_out_per_second", "gauge",
+                 "Messages sent per second over the last interval.", ms->outRate);
+    MetricsValue(f, "battleship_bytes_in_total", "counter", "Bytes received.",
+                 (double)COUNTER_GET(all.net.io.bytesIn));
+    MetricsValue(f, "battleship_bytes_out_total", "counter", "Bytes sent.",
+                 (double)COUNTER_GET(all.net.io.bytesOut));
+    MetricsValue(f, "battleship_syscalls_total", "counter",
+                 "System calls made by the event loops.", (double)COUNTER_GET(all.stats.syscalls));
+    MetricsValue(f, "battleship_accept_queue_depth", "gauge",
+                 "Connections waiting to be accepted, all shards.", queued);
+    MetricsValue(f, "battleship_accept_queue_limit", "gauge",
+                 "Size of the accept queues, all shards.", queueLimit);
+    MetricsValue(f, "battleship_shards", "gauge", "Event loop threads.",
+                 (double)ms->shardCount);
+    MetricsSummary(f, "battleship_turn_latency_seconds",
+                   "Server SHOT to the client's next SHOT.", &all.net.turn);
+    MetricsSummary(f, "battleship_shot_rtt_seconds",
+                   "Server SHOT to its RESULT.", &all.net.rtt);
+}
+
+/* Take new message rates; called once per interval */
+void MetricsTick(MetricsServer *ms) {
+    uint64_t now = NowNanos();
+    uint64_t in = 0, out = 0;
+    int n = atomic_load(&loopCount);
+    for (int i = 0; i < n && i < MAX_LOOPS; ++i) {
+        if (!loopCounters[i]) continue;
+        in += COUNTER_GET(loopCounters[i]->net.io.msgsIn);
+        out += COUNTER_GET(loopCounters[i]->net.io.msgsOut);
+    }
+    if (ms->lastAt) {
+        double secs = (double)(now - ms->lastAt) / 1e9;
+        ms->inRate = (double)(in - ms->lastIn) / secs;
+        ms->outRate = (double)(out - ms->lastOut) / secs;
+    }
+    ms->lastAt = now;
+    ms->lastIn = in;
+    ms->lastOut = out;
+
+    if (ms->path) {
+        char tmp[1024];
+        snprintf(tmp, sizeof(tmp), "%s.tmp", ms->path);
+        FILE *f = fopen(tmp, "w");
+        if (!f) { perror(tmp); return; }
+        MetricsWrite(ms, f);
+        if (fclose(f) != 0 || rename(tmp, ms->path) < 0) perror(ms->path);
+    }
+}
+
+/* Answer one HTTP request with the metrics page and close the connection */
+void MetricsServe(MetricsServer *ms, int fd) {
+    /* Read up to the end of the request headers; a client that sends
+       nothing for a second gets the page anyway */
+    struct timeval tv = { 1, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    char req[2048];
+    size_t got = 0;
+    while (got < sizeof(req) - 1) {
+        ssize_t n = recv(fd, req + got, sizeof(req) - 1 - got, 0);
+        if (n <= 0) break;
+        got += (size_t)n;
+        req[got] = '\0';
+        if (strstr(req, "\r\n\r\n") || strstr(req, "\n\n")) break;
+    }
+
+    char *page = NULL;
+    size_t len = 0;
+    FILE *f = open_memstream(&page, &len);
+    if (f) {
+        fputs("HTTP/1.0 200 OK\r\n"
+              "Content-Type: text/plain; version=0.0.4\r\n"
+              "Connection: close\r\n\r\n", f);
+        MetricsWrite(ms, f);
+        fclose(f);
+        /* MSG_NOSIGNAL: a scraper that hangs up must not stop the server */
+        for (size_t sent = 0; sent < len; ) {
+            ssize_t n = send(fd, page + sent, len - sent, MSG_NOSIGNAL);
+            if (n <= 0) break;
+            sent += (size_t)n;
+        }
+        free(page);
+    }
+    close(fd);
+}
+
+void *MetricsThread(void *arg) {
+    MetricsServer *ms = arg;
+    uint64_t next = NowNanos();
+    while (!stopServer) {
+        uint64_t now = NowNanos();
+        if (now >= next) {
+            MetricsTick(ms);
+            next = now + METRICS_INTERVAL_NS;
+        }
+        struct pollfd pfd = { ms->listenfd, POLLIN, 0 };
+        int wait = (int)((next - now) / 1000000) + 1;
+        if (poll(&pfd, ms->listenfd >= 0 ? 1 : 0, wait) > 0) {
+            int fd = accept(ms->listenfd, NULL, NULL);
+            if (fd >= 0) MetricsServe(ms, fd);
+        }
+    }
+    if (ms->path) MetricsTick(ms); /* leave the final numbers behind */
+    return NULL;
+}
+
+/* Start the metrics thread if --metrics-port or --metrics-file was given.
+   Returns 1 if it runs, 0 if not needed, -1 on error. */
+int StartMetrics(MetricsServer *ms, const Shard *shards, int count, pthread_t *thread) {
+    if (!ms->port && !ms->path) return 0;
+    ms->shards = shards;
+    ms->shardCount = count;
+    if (ms->port) {
+        ms->listenfd = OpenListener(ms->port, 16, 0);
+        if (ms->listenfd < 0) return -1;
+    }
+    if (pthread_create(thread, NULL, MetricsThread, ms) != 0) {
+        perror("pthread_create");
+        if (ms->listenfd >= 0) close(ms->listenfd);
+        return -1;
+    }
+    return 1;
+}
+
+/* Open the shard's listener. Returns -1 on error. */
+int ShardInit(Shard *sh, int id, int port, uint64_t seed) {
+    sh->id = id;
+    sh->epfd = -1;
+    sh->ring.fd = -1;
+    PoolInit(&sh->pool, sizeof(Match), MATCH_POOL_CHUNK);
+    RngSeed(&sh->rng, seed);
+    if (replayOut && ReplayWriterInit(&sh->replay, replayOut) < 0) return -1;
+
+    sh->listenfd = OpenListener(port, SOMAXCONN, 1);
+    if (sh->listenfd < 0) return -1;
+    if (SetNonBlocking(sh->listenfd) < 0) { perror("fcntl"); return -1; }
+    return 0;
+}
+
+/* Set up the shard's io_uring or epoll set. Called on the shard's own
+   thread: a ring may only be driven by the thread that made it. */
+static int ShardOpenLoop(Shard *sh) {
+    if (serverIo == IO_URING) {
+        if (RingInit(&sh->ring) == 0) {
+            sh->uring = 1;
+            return 0;
+        }
+        if (sh->id == 0) fprintf(stderr, "io_uring not available (%s), using epoll\n", strerror(errno));
+    }
+
+    sh->epfd = epoll_create1(0);
+    if (sh->epfd < 0) { perror("epoll_create1"); return -1; }
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL; /* NULL marks the listening socket */
+    if (epoll_ctl(sh->epfd, EPOLL_CTL_ADD, sh->listenfd, &ev) < 0) {
+        perror("epoll_ctl");
+        return -1;
+    }
+    return 0;
+}
+
+void ShardDestroy(Shard *sh) {
+    if (sh->uring) RingDestroy(&sh->ring);
+    if (sh->epfd >= 0) close(sh->epfd);
+    if (sh->listenfd >= 0) close(sh->listenfd);
+    ReplayWriterDestroy(&sh->replay);
+    PoolDestroy(&sh->pool);
+}
+
+/* The epoll loop */
+static void ShardRunEpoll(Shard *sh) {
+    struct epoll_event events[MAX_EVENTS];
+    while (!stopServer) {
+        int n = epoll_wait(sh->epfd, events, MAX_EVENTS, 1000);
+        COUNTER_ADD(counters->stats.syscalls, 1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
+        }
+        if (n == 0) ReplayWriterFlush(&sh->replay); /* quiet second: save replays */
+        if (sh->id == 0 && dumpServerStats) {
+            dumpServerStats = 0;
+            PrintServerStats();
+        }
+        for (int i = 0; i < n; ++i) {
+            Match *m = events[i].data.ptr;
+            if (!m) {
+                AcceptMatches(sh);
+                continue;
+            }
+            int drop = 0;
+            if (events[i].events & (EPOLLERR | EPOLLHUP)) drop = 1;
+            if (!drop && (events[i].events & EPOLLIN) && MatchRead(m) < 0) drop = 1;
+            if (!drop) {
+                int flushed = MatchFlush(m, sh->epfd);
+                if (flushed < 0) drop = 1;
+                else if (flushed && m->state == MATCH_CLOSING) {
+                    COUNTER_ADD(counters->stats.finished, 1);
+                    MatchClose(sh, m);
+                    continue;
+                }
+            }
+            if (drop) {
+                if (m->state == MATCH_CLOSING) COUNTER_ADD(counters->stats.finished, 1);
+                else                           COUNTER_ADD(counters->stats.errors, 1);
+                MatchClose(sh, m);
+            }
+        }
+    }
+}
+
+/*
+ * The io_uring loop. The listener has a multishot accept and every match
+ * a multishot recv drawing on the shard's buffer ring, plus at most one
+ * send of its output buffer. Completions carry the Match pointer with the
+ * kind of request in its low bits (pool slots are 64-byte aligned). A
+ * closing match cancels its requests and keeps its slot until the last
+ * of them has completed.
+ */
+
+enum {
+    URING_IGNORE,   /* cancel and close: nothing to do */
+    URING_ACCEPT,
+    URING_RECV,
+    URING_SEND
+};
+#define URING_TAG_MASK 7ULL
+
+static inline uint64_t UringData(Match *m, int tag) {
+    return (uint64_t)(uintptr_t)m | (uint64_t)tag;
+}
+
+static int UringArmAccept(Shard *sh) {
+    struct io_uring_sqe *sqe = RingGetSqe(&sh->ring);
+    if (!sqe) return -1;
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = sh->listenfd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = URING_ACCEPT;
+    return 0;
+}
+
+static int UringArmRecv(Shard *sh, Match *m) {
+    struct io_uring_sqe *sqe = RingGetSqe(&sh->ring);
+    if (!sqe) return -1;
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = m->fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = RING_BUF_GROUP;
+    sqe->user_data = UringData(m, URING_RECV);
+    m->recving = 1;
+    m->inflight++;
+    return 0;
+}
+
+/* Send the queued output unless a send is already out */
+static int UringFlush(Shard *sh, Match *m) {
+    if (m->sending || m->outSent == m->outLen) return 0;
+    struct io_uring_sqe *sqe = RingGetSqe(&sh->ring);
+    if (!sqe) return -1;
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = m->fd;
+    sqe->addr = (uint64_t)(uintptr_t)(m->out + m->outSent);
+    sqe->len = (uint32_t)(m->outLen - m->outSent);
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = UringData(m, URING_SEND);
+    ProtoCountSends(&m->proto, 1);
+    m->sending = 1;
+    m->inflight++;
+    return 0;
+}
+
+/* Close the socket and free the slot once the kernel holds nothing of the match */
+static void UringRelease(Shard *sh, Match *m) {
+    if (!m->closing || m->inflight) return;
+    struct io_uring_sqe *sqe = RingGetSqe(&sh->ring);
+    if (sqe) {
+        sqe->opcode = IORING_OP_CLOSE;
+        sqe->fd = m->fd;
+        sqe->user_data = URING_IGNORE;
+    } else {
+        close(m->fd);
+        COUNTER_ADD(counters->stats.syscalls, 1);
+    }
+    PoolRelease(&sh->pool, m);
+}
+
+/* Stop a match. Its slot goes back with the UringRelease() that every
+   completion handler ends with. */
+static void UringClose(Shard *sh, Match *m, int finished) {
+    if (m->closing) return;
+    m->closing = 1;
+    if (finished) COUNTER_ADD(counters->stats.finished, 1);
+    else          COUNTER_ADD(counters->stats.errors, 1);
+    MatchFinish(sh, m);
+    if (m->inflight) {
+        struct io_uring_sqe *sqe = RingGetSqe(&sh->ring);
+        if (sqe) {
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->fd = m->fd;
+            sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+            sqe->user_data = URING_IGNORE;
+        } else {
+            shutdown(m->fd, SHUT_RDWR); /* ends the recv and send just the same */
+            COUNTER_ADD(counters->stats.syscalls, 1);
+        }
+    }
+}
+
+/* After input or a finished send: send what is queued, or close a match
+   that has nothing left to say */
+static void UringProgress(Shard *sh, Match *m) {
+    if (UringFlush(sh, m) < 0) {
+        UringClose(sh, m, 0);
+    } else if (!m->sending && m->state == MATCH_CLOSING) {
+        UringClose(sh, m, 1);
+    }
+}
+
+static void UringStartMatch(Shard *sh, int fd) {
+    Match *m = PoolAcquire(&sh->pool);
+    if (!m) {
+        close(fd);
+        COUNTER_ADD(counters->stats.syscalls, 1);
+        COUNTER_ADD(counters->stats.errors, 1);
+        return;
+    }
+    MatchInit(sh, m, fd);
+    COUNTER_ADD(counters->stats.active, 1);
+    COUNTER_ADD(counters->stats.accepted, 1);
+    /* Server shoots first */
+    if (UringArmRecv(sh, m) < 0 || MatchSendShot(m) < 0) UringClose(sh, m, 0);
+    else                                                 UringProgress(sh, m);
+    UringRelease(sh, m);
+}
+
+static void UringRecvDone(Shard *sh, Match *m, const struct io_uring_cqe *cqe) {
+    int more = (cqe->flags & IORING_CQE_F_MORE) != 0;
+    if (!more) {
+        m->recving = 0;
+        m->inflight--;
+    }
+    int bad = 0;
+    if (cqe->res > 0 && (cqe->flags & IORING_CQE_F_BUFFER)) {
+        unsigned short bid = (unsigned short)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+        ProtoCountReads(&m->proto, 1);
+        if (!m->closing && LineReaderPush(&m->in, RingBuffer(&sh->ring, bid), (size_t)cqe->res) < 0) {
+            bad = 1;
+        }
+        RingReturnBuffer(&sh->ring, bid);
+        if (!m->closing && (bad || MatchProcess(m) < 0)) {
+            if (bad) COUNTER_ADD(counters->stats.malformed, 1);
+            UringClose(sh, m, m->state == MATCH_CLOSING);
+        } else if (!m->closing) {
+            UringProgress(sh, m);
+        }
+    } else if (!m->closing && cqe->res != -ENOBUFS) {
+        /* The client hung up (0) or the socket failed */
+        UringClose(sh, m, m->state == MATCH_CLOSING);
+    }
+    /* A multishot recv also stops when the buffers run out; start another */
+    if (!m->closing && !m->recving && UringArmRecv(sh, m) < 0) UringClose(sh, m, 0);
+    UringRelease(sh, m);
+}
+
+static void UringSendDone(Shard *sh, Match *m, int res) {
+    m->sending = 0;
+    m->inflight--;
+    if (!m->closing) {
+        if (res < 0) {
+            UringClose(sh, m, 0);
+        } else {
+            m->outSent += (size_t)res;
+            if (m->outSent == m->outLen) m->outSent = m->outLen = 0;
+            UringProgress(sh, m);
+        }
+    }
+    UringRelease(sh, m);
+}
+
+static void ShardRunUring(Shard *sh) {
+    IoRing *r = &sh->ring;
+    long enters = r->enters;
+    if (UringArmAccept(sh) < 0) return;
+    while (!stopServer) {
+        if (RingSubmitAndWait(r, 1000) < 0) {
+            if (errno == ETIME) {
+                ReplayWriterFlush(&sh->replay); /* quiet second: save replays */
+            } else if (errno != EINTR && errno != EBUSY) {
+                perror("io_uring_enter");
+                break;
+            }
+        }
+        COUNTER_ADD(counters->stats.syscalls, r->enters - enters);
+        enters = r->enters;
+        if (sh->id == 0 && dumpServerStats) {
+            dumpServerStats = 0;
+            PrintServerStats();
+        }
+
+        unsigned head = *r->cqHead;
+        unsigned tail = __atomic_load_n(r->cqTail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head) {
+            const struct io_uring_cqe *cqe = &r->cqes[head & *r->cqMask];
+            Match *m = (Match *)(uintptr_t)(cqe->user_data & ~URING_TAG_MASK);
+            switch ((int)(cqe->user_data & URING_TAG_MASK)) {
+            case URING_ACCEPT:
+                if (cqe->res >= 0) UringStartMatch(sh, cqe->res);
+                else if (cqe->res != -EAGAIN) fprintf(stderr, "accept: %s\n", strerror(-cqe->res));
+                if (!(cqe->flags & IORING_CQE_F_MORE)) UringArmAccept(sh);
+                break;
+            case URING_RECV:
+                UringRecvDone(sh, m, cqe);
+                break;
+            case URING_SEND:
+                UringSendDone(sh, m, cqe->res);
+                break;
+            default:
+                break;
+            }
+        }
+        __atomic_store_n(r->cqHead, head, __ATOMIC_RELEASE);
+    }
+}
+
+/* One shard's event loop; runs until SIGINT/SIGTERM */
+void *ShardLoop(void *arg) {
+    Shard *sh = arg;
+    unsigned long allocStart = allocCount;
+    counters = sh->counters;
+    if (ShardOpenLoop(sh) < 0) {
+        stopServer = 1;
+        return NULL;
+    }
+    if (sh->uring) ShardRunUring(sh);
+    else           ShardRunEpoll(sh);
+    sh->allocs = allocCount - allocStart;
+    return NULL;
+}
+
+/* Run the sharded server until SIGINT/SIGTERM */
+int RunMatchServer(int port, int shardCount) {
+    if (shardCount < 1) shardCount = 1;
+    if (shardCount > MAX_LOOPS) shardCount = MAX_LOOPS;
+    RaiseFileLimit();
+    Shard *shards = aligned_alloc(_Alignof(Shard), (size_t)shardCount * sizeof(Shard));
+    if (!shards) { perror("aligned_alloc"); return -1; }
+    memset(shards, 0, (size_t)shardCount * sizeof(Shard));
+
+    int started = 0, rc = 0;
+    for (int i = 0; i < shardCount; ++i) {
+        shards[i].listenfd = shards[i].epfd = -1;
+        if (ShardInit(&shards[i], i, port, RngNext(&gameRng)) < 0 ||
+            !(shards[i].counters = RegisterLoopCounters())) {
+            shardCount = i + 1;
+            rc = -1;
+            goto done;
+        }
+    }
+
+    signal(SIGINT, HandleStopSignal);
+    signal(SIGTERM, HandleStopSignal);
+    signal(SIGUSR1, HandleDumpSignal);
+    pthread_t metricsThread;
+    int metrics = StartMetrics(&metricsServer, shards, shardCount, &metricsThread);
+    if (metrics < 0) { rc = -1; goto done; }
+
+    for (started = 0; started < shardCount; ++started) {
+        if (pthread_create(&shards[started].thread, NULL, ShardLoop, &shards[started]) != 0) {
+            perror("pthread_create");
+            stopServer = 1;
+            rc = -1;
+            break;
+        }
+    }
+    if (rc == 0) {
+        printf("Serving matches against the computer on port %d with %d event loop%s (Ctrl-C to stop, SIGUSR1 for counters).\n",
+               port, shardCount, shardCount == 1 ? "" : "s");
+        if (metricsServer.port) printf("Metrics on http://localhost:%d/metrics\n", metricsServer.port);
+        fflush(stdout);
+        atomic_store(&serverReady, 1);
+    }
+    for (int i = 0; i < started; ++i) pthread_join(shards[i].thread, NULL);
+    if (metrics > 0) {
+        stopServer = 1;
+        pthread_join(metricsThread, NULL);
+        if (metricsServer.listenfd >= 0) close(metricsServer.listenfd);
+    }
+
+    LoopCounters *all = &serverTotals;
+    MergeLoopCounters(all);
+    printf("\nServer stopped. accepted=%ld finished=%ld errors=%ld still open=%ld\n",
+           COUNTER_GET(all->stats.accepted), COUNTER_GET(all->stats.finished),
+           COUNTER_GET(all->stats.errors), COUNTER_GET(all->stats.active));
+    if (shardCount > 1) {
+        printf("Accepted per shard:");
+        for (int i = 0; i < started; ++i) printf(" %ld", COUNTER_GET(shards[i].counters->stats.accepted));
+        printf("\n");
+    }
+    NetMetricsPrint(&all->net);
+    uint64_t msgs = COUNTER_GET(all->net.io.msgsIn) + COUNTER_GET(all->net.io.msgsOut);
+    long syscalls = COUNTER_GET(all->stats.syscalls);
+    printf("system calls:     %ld (%.2f per message, %s)\n", syscalls,
+           msgs ? (double)syscalls / (double)msgs : 0.0,
+           shards[0].uring ? "io_uring" : "epoll");
+    size_t slots = 0;
+    unsigned long allocs = 0;
+    for (int i = 0; i < started; ++i) {
+        slots += shards[i].pool.capacity;
+        allocs += shards[i].allocs;
+    }
+    printf("Match slots: %zu allocated, %lu heap allocations in total\n", slots, allocs);
+
+done:
+    atomic_store(&serverReady, 0);
+    for (int i = 0; i < shardCount; ++i) ShardDestroy(&shards[i]);
+    free(shards);
+    ReleaseLoopCounters();
+    return rc;
+}
+
+/* Load generator */
+
+/*
+ * --load <ip> <port> plays many games against a server at once, the
+ * computer choosing the client's shots. Every connection is non-blocking
+ * and all of them share one epoll loop. When a game ends the connection is
+ * closed and a new one opened, until --games games are done or --seconds
+ * have passed. A turn is timed from sending our SHOT to reading its RESULT.
+ */
+
+#define LOAD_OUTBUF 256
+
+typedef enum {
+    LOAD_CONNECTING,   /* waiting for connect() to finish */
+    LOAD_WAIT_SHOT,    /* waiting for the server's SHOT */
+    LOAD_WAIT_RESULT,  /* our SHOT is out, waiting for its RESULT */
+    LOAD_CLOSING       /* game over: send what is left, then close */
+} LoadState;
+
+/* One simulated player */
+typedef struct {
+    int fd;
+    LoadState state;
+    GameState game;
+    Rng rng;
+    int lastRow, lastCol;
+    uint64_t sentAt;   /* when our last SHOT went out */
+    LineReader in;
+    ProtoState proto;
+    size_t outLen, outSent;
+    uint32_t events;   /* events registered with epoll for fd */
+    char out[LOAD_OUTBUF];
+} LoadClient;
+
+typedef struct {
+    struct sockaddr_in addr;
+    int epfd;
+    long gamesWanted;      /* 0 = run until the time is up */
+    long gamesStarted;
+    uint64_t deadline;     /* NowNanos() value to stop at */
+    long active;
+    long finished, won, lost;
+    long moves;            /* shots fired by either side */
+    long connectErrors, disconnects, protocolErrors;
+    double elapsed;        /* seconds, once the run is over */
+    LatencyHistogram turn;
+} LoadRun;
+
+/* Start a new game on a fresh connection. Returns -1 if connect fails. */
+int LoadConnect(LoadRun *run, LoadClient *c) {
+    c->fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (c->fd < 0 || SetNonBlocking(c->fd) < 0) {
+        if (c->fd >= 0) close(c->fd);
+        c->fd = -1;
+        return -1;
+    }
+    int one = 1;
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(c->fd, (struct sockaddr *)&run->addr, sizeof(run->addr)) < 0 && errno != EINPROGRESS) {
+        close(c->fd);
+        c->fd = -1;
+        return -1;
+    }
+    c->state = LOAD_CONNECTING;
+    c->outLen = c->outSent = 0;
+    LineReaderInit(&c->in);
+    ProtoInit(&c->proto);
+    InitGame(&c->game, &c->rng);
+
+    struct epoll_event ev;
+    ev.events = c->events = EPOLLOUT;
+    ev.data.ptr = c;
+    if (epoll_ctl(run->epfd, EPOLL_CTL_ADD, c->fd, &ev) < 0) {
+        close(c->fd);
+        c->fd = -1;
+        return -1;
+    }
+    run->gamesStarted++;
+    run->active++;
+    return 0;
+}
+
+/* More games to start? */
+static int LoadWantMore(const LoadRun *run) {
+    if (run->gamesWanted > 0) return run->gamesStarted < run->gamesWanted;
+    return NowNanos() < run->deadline;
+}
+
+/* Close this game's connection and start the next one if there is time */
+void LoadRestart(LoadRun *run, LoadClient *c) {
+    epoll_ctl(run->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    c->fd = -1;
+    run->active--;
+    while (LoadWantMore(run)) {
+        if (LoadConnect(run, c) == 0) return;
+        run->connectErrors++;
+        if (run->connectErrors > 1000 && run->finished == 0) return; /* nobody is listening */
+    }
+}
+
+int LoadQueue(LoadClient *c, MessageType type, int row, int col, int flags) {
+    if (sizeof(c->out) - c->outLen < LINE_BUF) return -1;
+    c->outLen += (size_t)FormatMessage(&c->proto, c->out + c->outLen, type, row, col, flags);
+    return 0;
+}
+
+/* Same as MatchFlush, for a load client */
+int LoadFlush(LoadRun *run, LoadClient *c) {
+    while (c->outSent < c->outLen) {
+        ssize_t n = send(c->fd, c->out + c->outSent, c->outLen - c->outSent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        c->outSent += (size_t)n;
+    }
+    int done = c->outSent == c->outLen;
+    if (done) c->outSent = c->outLen = 0;
+    uint32_t want = done ? EPOLLIN : (EPOLLIN | EPOLLOUT);
+    if (want != c->events) {
+        struct epoll_event ev;
+        ev.events = want;
+        ev.data.ptr = c;
+        epoll_ctl(run->epfd, EPOLL_CTL_MOD, c->fd, &ev);
+        c->events = want;
+    }
+    return done;
+}
+
+/* Handle one message from the server. Returns -1 on a protocol error. */
+int LoadHandleMessage(LoadRun *run, LoadClient *c, const Message *msg) {
+    if (ProtoReceived(&c->proto, msg) < 0) return -1;
+    if (msg->type == MSG_QUIT) {
+        if (c->state != LOAD_CLOSING) run->disconnects++;
+        c->state = LOAD_CLOSING;
+        return 0;
+    }
+
+    if (c->state == LOAD_WAIT_SHOT) {
+        int r = msg->row, col = msg->col;
+        if (msg->type != MSG_SHOT || r < 0 || r >= GRID_SIZE || col < 0 || col >= GRID_SIZE) return -1;
+        run->moves++;
+        int result = ApplyShotToGrid(&c->game.playerShips, r, col);
+        if (LoadQueue(c, MSG_RESULT, r, col, result) < 0) return -1;
+        if (result & RESULT_WIN) {
+            run->finished++;
+            run->lost++;
+            c->state = LOAD_CLOSING;
+            return 0;
+        }
+        ComputerPickShot(&c->game.playerShots, &c->rng, &c->lastRow, &c->lastCol);
+        if (LoadQueue(c, MSG_SHOT, c->lastRow, c->lastCol, 0) < 0) return -1;
+        c->sentAt = NowNanos();
+        c->state = LOAD_WAIT_RESULT;
+        return 0;
+    }
+
+    if (c->state == LOAD_WAIT_RESULT) {
+        if (msg->type != MSG_RESULT) return -1;
+        LatencyRecord(&run->turn, NowNanos() - c->sentAt);
+        run->moves++;
+        RecordShot(&c->game.playerShots, c->lastRow, c->lastCol, (msg->flags & RESULT_HIT) != 0);
+        if ((msg->flags & RESULT_HIT) && (msg->flags & RESULT_SUNK)) {
+            RecordSunk(&c->game.playerShots, ResultShip(msg->flags), c->lastRow, c->lastCol);
+        }
+        if ((msg->flags & RESULT_WIN) || BitboardCount(c->game.playerShots.hits) == FleetCells()) {
+            run->finished++;
+            run->won++;
+            c->state = LOAD_CLOSING;
+            return 0;
+        }
+        c->state = LOAD_WAIT_SHOT;
+        return 0;
+    }
+
+    return 0; /* closing: the server's QUIT or anything else is fine */
+}
+
+/* Handle readiness on one connection */
+void LoadEvent(LoadRun *run, LoadClient *c, uint32_t events) {
+    if (c->state == LOAD_CONNECTING) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0) {
+            run->connectErrors++;
+            LoadRestart(run, c);
+            return;
+        }
+        c->state = LOAD_WAIT_SHOT; /* server shoots first */
+        LoadFlush(run, c);
+        return;
+    }
+
+    if (events & EPOLLIN) {
+        while (1) {
+            ssize_t n = LineReaderFill(&c->in, c->fd);
+            if (n == 0) {
+                if (c->state != LOAD_CLOSING) run->disconnects++;
+                LoadRestart(run, c);
+                return;
+            }
+            if (n < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                if (errno == EINTR) continue;
+                if (c->state != LOAD_CLOSING) run->disconnects++;
+                LoadRestart(run, c);
+                return;
+            }
+            Message msg;
+            int got;
+            while ((got = ReaderNextMessage(&c->in, &msg)) > 0) {
+                if (LoadHandleMessage(run, c, &msg) < 0) {
+                    run->protocolErrors++;
+                    LoadRestart(run, c);
+                    return;
+                }
+            }
+            if (got < 0) {
+                run->protocolErrors++;
+                LoadRestart(run, c);
+                return;
+            }
+        }
+    } else if (events & (EPOLLERR | EPOLLHUP)) {
+        if (c->state != LOAD_CLOSING) run->disconnects++;
+        LoadRestart(run, c);
+        return;
+    }
+
+    int flushed = LoadFlush(run, c);
+    if (flushed < 0) {
+        if (c->state != LOAD_CLOSING) run->disconnects++;
+        LoadRestart(run, c);
+    } else if (flushed && c->state == LOAD_CLOSING) {
+        LoadRestart(run, c);
+    }
+}
+
+/* Run `clients` players against ip:port and print what we measured.
+   If result is not NULL the totals are also copied there. */
+int RunLoadGenerator(const char *ip, int port, int clients, long games, double seconds,
+                     LoadRun *result) {
+    LoadRun run;
+    memset(&run, 0, sizeof(run));
+    run.addr.sin_family = AF_INET;
+    run.addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, ip, &run.addr.sin_addr) <= 0) {
+        fprintf(stderr, "Invalid IP address: %s\n", ip);
+        return 1;
+    }
+    run.gamesWanted = games;
+    run.deadline = NowNanos() + (uint64_t)(seconds * 1e9);
+
+    RaiseFileLimit();
+    run.epfd = epoll_create1(0);
+    if (run.epfd < 0) { perror("epoll_create1"); return 1; }
+    LoadClient *players = calloc((size_t)clients, sizeof(LoadClient));
+    if (!players) { perror("calloc"); close(run.epfd); return 1; }
+
+    signal(SIGINT, HandleStopSignal);
+    signal(SIGTERM, HandleStopSignal);
+    printf("Load: %d clients against %s:%d ", clients, ip, port);
+    if (games > 0) printf("for %ld games\n", games);
+    else           printf("for %.0f seconds\n", seconds);
+
+    uint64_t start = NowNanos();
+    for (int i = 0; i < clients && LoadWantMore(&run); ++i) {
+        RngSeed(&players[i].rng, RngNext(&gameRng));
+        players[i].fd = -1;
+        if (LoadConnect(&run, &players[i]) < 0) run.connectErrors++;
+    }
 
-    GameState *localGame = malloc(sizeof(GameState));
-    if (!localGame) {
-        perror("malloc");
-        close(clientfd);
-        return -1;
+    struct epoll_event events[MAX_EVENTS];
+    while (run.active > 0 && !stopServer) {
+        int n = epoll_wait(run.epfd, events, MAX_EVENTS, 100);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
+        }
+        for (int i = 0; i < n; ++i) LoadEvent(&run, events[i].data.ptr, events[i].events);
+        if (games == 0 && NowNanos() > run.deadline + 5000000000ULL) break; /* stuck games */
+    }
+    double elapsed = (double)(NowNanos() - start) / 1e9;
+    if (elapsed <= 0) elapsed = 1e-9;
+    run.elapsed = elapsed;
+
+    printf("seconds:          %.3f\n", elapsed);
+    printf("games finished:   %ld (client won %ld, server won %ld)\n", run.finished, run.won, run.lost);
+    if (run.won + run.lost > 0) {
+        /* --ai against the server's density shots; the server shoots first */
+        printf("client win rate:  %.2f%% with --ai %s\n", 100.0 * (double)run.won / (double)(run.won + run.lost),
+               StrategyName(computerStrategy));
+    }
+    if (exactCounted + exactFallback > 0) {
+        /* sunk ships come from the RESULTs; without them nothing would count */
+        printf("exact counts:     %.1f%% of shots (the rest from the density map)\n",
+               100.0 * (double)exactCounted / (double)(exactCounted + exactFallback));
+    }
+    printf("games/sec:        %.0f\n", (double)run.finished / elapsed);
+    printf("moves:            %ld\n", run.moves);
+    printf("moves/sec:        %.0f\n", (double)run.moves / elapsed);
+    LatencyPrint("turn latency:", &run.turn);
+    printf("connect errors:   %ld\n", run.connectErrors);
+    printf("disconnects:      %ld\n", run.disconnects);
+    printf("protocol errors:  %ld\n", run.protocolErrors);
+    printf("unfinished:       %ld\n", run.active);
+
+    for (int i = 0; i < clients; ++i) {
+        if (players[i].fd >= 0) close(players[i].fd);
     }
-    localGame->playerShips = AllocateGrid();
-    localGame->playerShots = AllocateGrid();
-    RandomlyPlaceShips(localGame->playerShips);
+    free(players);
+    close(run.epfd);
+    if (result) *result = run;
+    return run.finished > 0 ? 0 : 1;
+}
+
+/* Loopback comparison of the server's I/O backends */
+
+/*
+ * --stress-io runs the match server on a background thread and the load
+ * generator against it over loopback, once with each backend, and prints
+ * throughput, turn latency and the server's system calls per message side
+ * by side.
+ */
+
+typedef struct {
+    int port;
+    int shards;
+    int rc;
+    atomic_int done;
+} StressServer;
+
+static void *StressServerThread(void *arg) {
+    StressServer *ss = arg;
+    ss->rc = RunMatchServer(ss->port, ss->shards);
+    atomic_store(&ss->done, 1);
+    return NULL;
+}
+
+int RunIoStress(int port, int shards, int clients, double seconds) {
+    static const IoBackend backends[] = { IO_EPOLL, IO_URING };
+    static const char *names[] = { "epoll", "io_uring" };
+    enum { RUNS = sizeof(backends) / sizeof(backends[0]) };
+    static LoadRun load[RUNS];
+    static LoopCounters server[RUNS];
 
-    PlayTwoPlayer(localGame, clientfd, 1); /* server shoots first */
+    for (int b = 0; b < RUNS; ++b) {
+        printf("=== %s ===\n", names[b]);
+        serverIo = backends[b];
+        stopServer = 0;
+        StressServer ss = { port, shards, 0, 0 };
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, StressServerThread, &ss) != 0) {
+            perror("pthread_create");
+            return 1;
+        }
+        while (!atomic_load(&serverReady) && !atomic_load(&ss.done)) {
+            struct timespec ts = { 0, 10000000 };
+            nanosleep(&ts, NULL);
+        }
+        if (!atomic_load(&ss.done)) {
+            RunLoadGenerator("127.0.0.1", port, clients, 0, seconds, &load[b]);
+        }
+        stopServer = 1;
+        pthread_join(tid, NULL);
+        if (ss.rc < 0) return 1;
+        server[b] = serverTotals;
+    }
 
-    FreeGrid(localGame->playerShips);
-    FreeGrid(localGame->playerShots);
-    free(localGame);
+    printf("\n%-10s %10s %10s %12s %12s %14s\n",
+           "backend", "games/s", "moves/s", "p50 turn us", "p99 turn us", "syscalls/msg");
+    for (int b = 0; b < RUNS; ++b) {
+        double elapsed = load[b].elapsed > 0 ? load[b].elapsed : 1;
+        uint64_t msgs = COUNTER_GET(server[b].net.io.msgsIn) + COUNTER_GET(server[b].net.io.msgsOut);
+        printf("%-10s %10.0f %10.0f %12.1f %12.1f %14.3f\n", names[b],
+               (double)load[b].finished / elapsed, (double)load[b].moves / elapsed,
+               (double)LatencyPercentile(&load[b].turn, 0.50) / 1e3,
+               (double)LatencyPercentile(&load[b].turn, 0.99) / 1e3,
+               msgs ? (double)COUNTER_GET(server[b].stats.syscalls) / (double)msgs : 0.0);
+    }
     return 0;
 }
 
-/* Run as client: connect to given ip:port and start game */
-int RunClientMode(const char *ip, int port) {
-    int sockfd = socket(AF_INET, SOCK_STREAM, 0);
-    if (sockfd < 0) { perror("socket"); return -1; }
+/* Headless simulation */
 
-    struct sockaddr_in servaddr;
-    memset(&servaddr, 0, sizeof(servaddr));
-    servaddr.sin_family = AF_INET;
-    servaddr.sin_port = htons(port);
-    if (inet_pton(AF_INET, &servaddr.sin_addr, ip) <= 0) {
-        fprintf(stderr, "Invalid IP address: %s\n", ip);
-        close(sockfd);
-        return -1;
+/* Play one computer-vs-computer game without any output.
+   Side 0 shoots first. Returns the number of shots fired in total
+   and stores the winning side in *winner. Both games live on the
+   stack, so a simulated game makes no heap calls at all.
+   If replay is not NULL the fleets and shots are written into it. */
+int SimulateGame(Rng *rng, int *winner, ReplayRecord *replay) {
+    GameState side[2];
+    InitGame(&side[0], rng);
+    InitGame(&side[1], rng);
+    if (replay) {
+        ReplaySetFleet(replay, 0, &side[0].playerShips);
+        ReplaySetFleet(replay, 1, &side[1].playerShips);
     }
 
-    printf("Connecting to %s:%d ...\n", ip, port);
-    if (connect(sockfd, (struct sockaddr*)&servaddr, sizeof(servaddr)) < 0) {
-        perror("connect");
-        close(sockfd);
-        return -1;
+    int turn = 0;
+    int shots = 0;
+    while (1) {
+        GameState *me = &side[turn];
+        GameState *them = &side[1 - turn];
+        int row, col;
+        /* The shooter reads only the hits, misses and sunk ships here */
+        ComputerPickShot(&them->playerShips, rng, &row, &col);
+        int result = ApplyShotToGrid(&them->playerShips, row, col);
+        RecordShot(&me->playerShots, row, col, result != 0);
+        if (replay) ReplayAddShot(replay, row, col);
+        shots++;
+        if (result & RESULT_WIN) break;
+        turn = 1 - turn;
     }
-    printf("Connected to server.\n");
 
-    GameState *localGame = malloc(sizeof(GameState));
-    if (!localGame) {
-        perror("malloc");
-        close(sockfd);
-        return -1;
+    *winner = turn;
+    if (replay) ReplaySetWinner(replay, turn);
+    return shots;
+}
+
+/* Games handed out to a worker at a time */
+#define SIM_BATCH 1024
+
+/* Work shared by all simulation threads: just a batch counter */
+typedef struct {
+    long games;
+    uint64_t seed;
+    atomic_long nextBatch;
+} SimJob;
+
+/* Totals from one worker. Aligned so two workers never share a cache line. */
+typedef struct {
+    _Alignas(64) SimJob *job;
+    long games;
+    long shots;
+    long firstWins;
+    uint64_t digest;
+    unsigned long allocs;
+    unsigned long frees;
+    TTStats tt;
+    ReplayWriter replay;  /* open only with --record */
+} SimWorker;
+
+/* Worker thread: grab batches of games until none are left.
+   Game g always uses the generator seeded with (seed, g), so results do not
+   depend on which thread plays it or in what order. */
+void *SimulationWorker(void *arg) {
+    SimWorker *w = arg;
+    SimJob *job = w->job;
+    unsigned long allocStart = allocCount;
+    unsigned long freeStart = freeCount;
+    ReplayRecord record;
+    ReplayRecord *replay = w->replay.file ? &record : NULL;
+
+    while (1) {
+        long first = atomic_fetch_add(&job->nextBatch, 1) * SIM_BATCH;
+        if (first >= job->games) break;
+        long last = first + SIM_BATCH;
+        if (last > job->games) last = job->games;
+
+        for (long g = first; g < last; ++g) {
+            uint64_t gameSeed = job->seed ^ ((uint64_t)g * 0xD1B54A32D192ED03ULL);
+            Rng rng;
+            RngSeed(&rng, gameSeed);
+            int winner;
+            if (replay) ReplayBegin(replay, gameSeed, REPLAY_SIM);
+            int shots = boardConfig.sparse ? SparseSimulateGame(&rng, &winner)
+                      : boardConfig.custom ? WideSimulateGame(&rng, &winner)
+                                           : SimulateGame(&rng, &winner, replay);
+            if (replay) ReplayAppend(&w->replay, replay);
+            w->games++;
+            w->shots += shots;
+            if (winner == 0) w->firstWins++;
+            /* Order-free checksum: same games give the same digest */
+            uint64_t mix = (uint64_t)g * 1000003ULL + (uint64_t)shots * 2 + (uint64_t)winner;
+            w->digest += SplitMix64(&mix);
+        }
+    }
+
+    w->allocs = allocCount - allocStart;
+    w->frees = freeCount - freeStart;
+    w->tt = ttStats;
+    return NULL;
+}
+
+/* Play many games on several threads with no terminal I/O and print
+   throughput numbers */
+int RunSimulation(long games, uint64_t seed, int threads) {
+    if (threads < 1) threads = 1;
+    SimJob job;
+    job.games = games;
+    job.seed = seed;
+    atomic_init(&job.nextBatch, 0);
+
+    /* calloc only promises max_align_t; workers must start on a cache line */
+    SimWorker *workers = aligned_alloc(_Alignof(SimWorker), (size_t)threads * sizeof(SimWorker));
+    pthread_t *tids = calloc((size_t)threads, sizeof(pthread_t));
+    if (!workers || !tids) { perror("alloc"); free(workers); free(tids); return 1; }
+    memset(workers, 0, (size_t)threads * sizeof(SimWorker));
+
+    double start = NowSeconds();
+    for (int t = 0; t < threads; ++t) {
+        workers[t].job = &job;
+        if (replayOut && ReplayWriterInit(&workers[t].replay, replayOut) < 0) {
+            threads = t;
+            break;
+        }
+        if (pthread_create(&tids[t], NULL, SimulationWorker, &workers[t]) != 0) {
+            perror("pthread_create");
+            threads = t;
+            break;
+        }
+    }
+    SimWorker total;
+    memset(&total, 0, sizeof(total));
+    for (int t = 0; t < threads; ++t) {
+        pthread_join(tids[t], NULL);
+        ReplayWriterDestroy(&workers[t].replay);
+        total.games += workers[t].games;
+        total.shots += workers[t].shots;
+        total.firstWins += workers[t].firstWins;
+        total.digest += workers[t].digest;
+        total.allocs += workers[t].allocs;
+        total.frees += workers[t].frees;
+        TTStatsMerge(&total.tt, &workers[t].tt);
+    }
+    double elapsed = NowSeconds() - start;
+    if (elapsed <= 0) elapsed = 1e-9;
+    free(workers);
+    free(tids);
+    if (total.games == 0) return 1;
+
+    printf("games:            %ld\n", total.games);
+    printf("seed:             %llu\n", (unsigned long long)seed);
+    printf("threads:          %d\n", threads);
+    printf("seconds:          %.3f\n", elapsed);
+    printf("games/sec:        %.0f\n", (double)total.games / elapsed);
+    printf("turns/game:       %.2f\n", (double)total.shots / (double)total.games);
+    printf("first shooter won %.2f%%\n", 100.0 * (double)total.firstWins / (double)total.games);
+    printf("allocations:      %lu (%.1f/game)\n", total.allocs,
+           (double)total.allocs / (double)total.games);
+    printf("frees:            %lu\n", total.frees);
+    if (transTable.entries) TTStatsPrint(&total.tt);
+    printf("digest:           %016llx\n", (unsigned long long)total.digest);
+    return 0;
+}
+
+/* Position solver */
+
+/*
+ * --solve reads a position and prints the exact chance of a ship on every
+ * cell (see "Exact posterior"). The position is GRID_SIZE lines of
+ * GRID_SIZE cells, spaces ignored: '.' not shot, 'o' miss, 'X' hit, '#'
+ * cell of a sunk ship. Each straight run of '#' is taken as one sunk ship
+ * of that length.
+ */
+
+#define SOLVE_MAX_STATES (1 << 22)
+
+/* Read a position for --solve into known; sunk and afloat as for
+   ComputeHeatMap. Returns -1 after printing what is wrong. */
+static int ReadPosition(FILE *in, Board *known, Bitboard *sunk, unsigned *afloat) {
+    char grid[GRID_SIZE][GRID_SIZE];
+    char line[LINE_BUF];
+    memset(known, 0, sizeof(*known));
+    memset(sunk, 0, sizeof(*sunk));
+    *afloat = (1u << NUM_SHIPS) - 1;
+    for (int r = 0; r < GRID_SIZE; ++r) {
+        if (!fgets(line, sizeof(line), in)) {
+            fprintf(stderr, "Position has %d rows, need %d\n", r, GRID_SIZE);
+            return -1;
+        }
+        int c = 0;
+        for (const char *p = line; *p && *p != '\n' && c < GRID_SIZE; ++p) {
+            if (*p == ' ') continue;
+            if (!strchr(".oX#", *p)) {
+                fprintf(stderr, "Row %c: '%c' is not one of . o X #\n", 'A' + r, *p);
+                return -1;
+            }
+            grid[r][c++] = *p;
+        }
+        if (c < GRID_SIZE) {
+            fprintf(stderr, "Row %c has %d cells, need %d\n", 'A' + r, c, GRID_SIZE);
+            return -1;
+        }
+    }
+
+    for (int r = 0; r < GRID_SIZE; ++r) {
+        for (int c = 0; c < GRID_SIZE; ++c) {
+            if (grid[r][c] == 'o') RecordShot(known, r, c, 0);
+            if (grid[r][c] == 'X') RecordShot(known, r, c, 1);
+            if (grid[r][c] != '#' || BitboardTest(*sunk, CellIndex(r, c))) continue;
+            /* a new sunk ship: it runs right or down from here */
+            int across = c + 1 < GRID_SIZE && grid[r][c + 1] == '#';
+            int len = 0;
+            while (across ? c + len < GRID_SIZE && grid[r][c + len] == '#'
+                          : r + len < GRID_SIZE && grid[r + len][c] == '#') ++len;
+            int s = NUM_SHIPS - 1;
+            while (s >= 0 && (ships[s].size != len || !(*afloat & (1u << s)))) --s;
+            if (s < 0) {
+                fprintf(stderr, "Sunk ship at %c%d: no ship of length %d left\n", 'A' + r, c, len);
+                return -1;
+            }
+            *afloat &= ~(1u << s);
+            Bitboard mask = ShipMask(r, c, len, !across);
+            *sunk = BitboardOr(*sunk, mask);
+            known->hits = BitboardOr(known->hits, mask);
+        }
+    }
+    return 0;
+}
+
+/* --solve: count the layouts that fit a position and print the chance of
+   a ship on each open cell, in percent */
+int RunSolver(const char *path, int threads) {
+    FILE *in = path ? fopen(path, "r") : stdin;
+    if (!in) { perror(path); return 1; }
+    Board known;
+    Bitboard sunk;
+    unsigned afloat;
+    int read = ReadPosition(in, &known, &sunk, &afloat);
+    if (path) fclose(in);
+    if (read < 0) return 1;
+
+    Posterior post;
+    double start = NowSeconds();
+    if (CountFleets(&known, sunk, afloat, threads, SOLVE_MAX_STATES, &post) < 0) {
+        fprintf(stderr, "Too many layouts to count at this position (more than %d states a level)\n", SOLVE_MAX_STATES);
+        return 1;
+    }
+    double elapsed = NowSeconds() - start;
+    if (post.layouts == 0) {
+        printf("No fleet fits this position.\n");
+        return 1;
+    }
+
+    Bitboard shot = BitboardOr(known.hits, known.misses);
+    int best = -1;
+    printf("    ");
+    for (int c = 0; c < GRID_SIZE; ++c) printf("%4d", c);
+    printf("\n");
+    for (int r = 0; r < GRID_SIZE; ++r) {
+        printf("%c   ", 'A' + r);
+        for (int c = 0; c < GRID_SIZE; ++c) {
+            int idx = CellIndex(r, c);
+            if (BitboardTest(shot, idx)) {
+                printf("%4s", BitboardTest(sunk, idx) ? "#" : BitboardTest(known.hits, idx) ? "X" : "o");
+                continue;
+            }
+            printf("%4.0f", 100.0 * (double)post.cover[idx] / (double)post.layouts);
+            if (best < 0 || post.cover[idx] > post.cover[best]) best = idx;
+        }
+        printf("\n");
+    }
+    printf("layouts:          %llu\n", (unsigned long long)post.layouts);
+    printf("states:           %ld\n", post.states);
+    printf("threads:          %d\n", threads);
+    printf("milliseconds:     %.1f\n", elapsed * 1e3);
+    if (best >= 0) {
+        printf("best shot:        %c%d (%.1f%%)\n", 'A' + best / GRID_SIZE, best % GRID_SIZE,
+               100.0 * (double)post.cover[best] / (double)post.layouts);
+    }
+    return 0;
+}
+
+/* Benchmarks */
+
+/*
+ * --bench times the core functions one at a time. Each benchmark runs in
+ * rounds; a round repeats the operation enough times to take about
+ * BENCH_ROUND_NS, and the ns/op of every round is kept so we can report
+ * percentiles as well as the mean. Heap calls are counted the same way the
+ * simulator counts them. --json writes the results for comparing versions.
+ */
+
+#define BENCH_ROUNDS 40
+#define BENCH_ROUND_NS 2000000.0
+#define BENCH_MAX_RESULTS 16
+
+/* Scratch data shared by the benchmark bodies */
+typedef struct {
+    Rng rng;
+    Board board;         /* a board with a fleet on it */
+    Board midGame;       /* shot knowledge with some hits and misses */
+    GameState sides[2];  /* a game half played */
+    PackedGame packed;   /* the same game packed */
+    ReplayRecord replay; /* a whole simulated game, for encoding */
+    int order[GRID_CELLS];
+    int next;
+    uint64_t sink;       /* results go here so nothing is optimised away */
+} BenchState;
+
+typedef void (*BenchFunc)(BenchState *b, long ops);
+
+typedef struct {
+    const char *name;
+    long opsPerRound;
+    double mean, min, p50, p90, p99;
+    double allocsPerOp;
+} BenchResult;
+
+static void BenchAllocateGrid(BenchState *b, long ops) {
+    for (long i = 0; i < ops; ++i) {
+        Board *grid = AllocateGrid();
+        b->sink += (uint64_t)(uintptr_t)grid;
+        FreeGrid(grid);
+    }
+}
+
+static void BenchInitGame(BenchState *b, long ops) {
+    GameState game;
+    for (long i = 0; i < ops; ++i) {
+        InitGame(&game, &b->rng);
+        b->sink += game.playerShips.ships.lo;
+    }
+}
+
+static void BenchPlaceShips(BenchState *b, long ops) {
+    for (long i = 0; i < ops; ++i) {
+        Board grid;
+        memset(&grid, 0, sizeof(grid));
+        RandomlyPlaceShips(&grid, &b->rng);
+        b->sink += grid.ships.lo;
+    }
+}
+
+static void BenchApplyShot(BenchState *b, long ops) {
+    for (long i = 0; i < ops; ++i) {
+        if (b->next == GRID_CELLS) {
+            /* every cell has been shot: clear the shots and go again */
+            BoardClearShots(&b->board);
+            b->next = 0;
+        }
+        int cell = b->order[b->next++];
+        b->sink += (uint64_t)ApplyShotToGrid(&b->board, cell / GRID_SIZE, cell % GRID_SIZE);
+    }
+}
+
+static void BenchAllShipsDestroyed(BenchState *b, long ops) {
+    for (long i = 0; i < ops; ++i) {
+        b->sink += (uint64_t)GridAllShipsDestroyed(&b->board);
+        b->board.hits.lo ^= (uint64_t)i & 1; /* keep the compiler from hoisting it */
+    }
+}
+
+static void BenchHeatMap(BenchState *b, long ops) {
+    uint32_t heat[GRID_CELLS];
+    Bitboard noneSunk = { 0, 0 };
+    for (long i = 0; i < ops; ++i) {
+        ComputeHeatMap(&b->midGame, noneSunk, (1u << NUM_SHIPS) - 1, heat);
+        b->sink += heat[i % GRID_CELLS];
+    }
+}
+
+static void BenchExactPosterior(BenchState *b, long ops) {
+    Posterior post;
+    Bitboard noneSunk = { 0, 0 };
+    for (long i = 0; i < ops; ++i) {
+        CountFleets(&b->midGame, noneSunk, (1u << NUM_SHIPS) - 1, 1, EXACT_MAX_STATES_AI, &post);
+        b->sink += post.layouts;
+    }
+}
+
+static void BenchRenderFrame(BenchState *b, long ops) {
+    FrameBuffer fb;
+    for (long i = 0; i < ops; ++i) {
+        fb.len = 0;
+        RenderGrid(&fb, &b->board, 0);
+        RenderGrid(&fb, &b->midGame, 1);
+        b->sink += fb.len;
+    }
+}
+
+static void BenchPrintGrid(BenchState *b, long ops) {
+    for (long i = 0; i < ops; ++i) PrintGrid(&b->midGame, (int)(i & 1));
+    b->sink += (uint64_t)ops;
+}
+
+static void BenchGameDensity(BenchState *b, long ops) {
+    ComputerStrategy saved = computerStrategy;
+    computerStrategy = AI_DENSITY;
+    for (long i = 0; i < ops; ++i) {
+        int winner;
+        b->sink += (uint64_t)SimulateGame(&b->rng, &winner, NULL);
+    }
+    computerStrategy = saved;
+}
+
+static void BenchGameRandom(BenchState *b, long ops) {
+    ComputerStrategy saved = computerStrategy;
+    computerStrategy = AI_RANDOM;
+    for (long i = 0; i < ops; ++i) {
+        int winner;
+        b->sink += (uint64_t)SimulateGame(&b->rng, &winner, NULL);
+    }
+    computerStrategy = saved;
+}
+
+static void BenchReplayEncode(BenchState *b, long ops) {
+    uint8_t out[REPLAY_RECORD_MAX];
+    for (long i = 0; i < ops; ++i) {
+        b->replay.seed = (uint64_t)i;
+        b->sink += ReplayEncode(&b->replay, out);
+    }
+}
+
+static void BenchPackGame(BenchState *b, long ops) {
+    for (long i = 0; i < ops; ++i) {
+        b->sides[0].playerShips.misses.lo ^= (uint64_t)i & 1; /* keep it from being hoisted */
+        PackGame(b->sides, &b->packed);
+        b->sink += b->packed.board[0].cells[0];
+    }
+}
+
+static void BenchUnpackGame(BenchState *b, long ops) {
+    GameState sides[2];
+    for (long i = 0; i < ops; ++i) {
+        b->packed.board[1].cells[0] ^= (uint8_t)(i & 1);
+        UnpackGame(&b->packed, sides);
+        b->sink += sides[1].playerShips.hits.lo;
     }
-    localGame->playerShips = AllocateGrid();
-    localGame->playerShots = AllocateGrid();
-    RandomlyPlaceShips(localGame->playerShips);
+}
+
+static int CompareDoubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* Value at fraction q of a sorted array */
+static double Percentile(const double *sorted, int n, double q) {
+    int idx = (int)(q * (n - 1) + 0.5);
+    return sorted[idx];
+}
+
+/* Run one benchmark: pick a round size, then time BENCH_ROUNDS rounds */
+static BenchResult RunBenchmark(const char *name, BenchFunc fn, BenchState *b) {
+    BenchResult res;
+    memset(&res, 0, sizeof(res));
+    res.name = name;
+
+    long ops = 1;
+    while (1) {
+        double start = NowSeconds();
+        fn(b, ops);
+        double ns = (NowSeconds() - start) * 1e9;
+        if (ns >= BENCH_ROUND_NS / 4 || ops >= (1L << 26)) {
+            if (ns > 0) ops = (long)((double)ops * BENCH_ROUND_NS / ns) + 1;
+            break;
+        }
+        ops *= 4;
+    }
+    res.opsPerRound = ops;
+
+    double samples[BENCH_ROUNDS];
+    unsigned long allocStart = allocCount;
+    for (int r = 0; r < BENCH_ROUNDS; ++r) {
+        double start = NowSeconds();
+        fn(b, ops);
+        samples[r] = (NowSeconds() - start) * 1e9 / (double)ops;
+        res.mean += samples[r] / BENCH_ROUNDS;
+    }
+    res.allocsPerOp = (double)(allocCount - allocStart) / ((double)ops * BENCH_ROUNDS);
+
+    qsort(samples, BENCH_ROUNDS, sizeof(double), CompareDoubles);
+    res.min = samples[0];
+    res.p50 = Percentile(samples, BENCH_ROUNDS, 0.50);
+    res.p90 = Percentile(samples, BENCH_ROUNDS, 0.90);
+    res.p99 = Percentile(samples, BENCH_ROUNDS, 0.99);
+    return res;
+}
+
+/* Write results as JSON */
+static int WriteBenchJson(const char *path, const BenchResult *res, int n) {
+    FILE *f = fopen(path, "w");
+    if (!f) { perror(path); return -1; }
+    fprintf(f, "{\n  \"benchmarks\": [\n");
+    for (int i = 0; i < n; ++i) {
+        fprintf(f, "    {\"name\": \"%s\", \"ops_per_round\": %ld, \"rounds\": %d, "
+                   "\"ns_per_op\": %.2f, \"min\": %.2f, \"p50\": %.2f, \"p90\": %.2f, "
+                   "\"p99\": %.2f, \"allocs_per_op\": %.3f}%s\n",
+                res[i].name, res[i].opsPerRound, BENCH_ROUNDS, res[i].mean, res[i].min,
+                res[i].p50, res[i].p90, res[i].p99, res[i].allocsPerOp,
+                i + 1 < n ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+    fclose(f);
+    return 0;
+}
+
+/* Run every benchmark whose name contains filter (NULL = all) */
+int RunBenchmarks(const char *filter, const char *jsonPath) {
+    static const struct { const char *name; BenchFunc fn; int printsToStdout; } benches[] = {
+        { "allocate_free_grid",    BenchAllocateGrid,      0 },
+        { "init_game",             BenchInitGame,          0 },
+        { "place_ships",           BenchPlaceShips,        0 },
+        { "apply_shot",            BenchApplyShot,         0 },
+        { "all_ships_destroyed",   BenchAllShipsDestroyed, 0 },
+        { "heat_map",              BenchHeatMap,           0 },
+        { "exact_posterior",       BenchExactPosterior,    0 },
+        { "render_frame",          BenchRenderFrame,       0 },
+        { "print_grid",            BenchPrintGrid,         1 },
+        { "game_density_ai",       BenchGameDensity,       0 },
+        { "game_random_ai",        BenchGameRandom,        0 },
+        { "replay_encode",         BenchReplayEncode,      0 },
+        { "pack_game",             BenchPackGame,          0 },
+        { "unpack_game",           BenchUnpackGame,        0 },
+    };
+    int count = (int)(sizeof(benches) / sizeof(benches[0]));
+
+    BenchState b;
+    memset(&b, 0, sizeof(b));
+    RngSeed(&b.rng, 12345);
+    RandomlyPlaceShips(&b.board, &b.rng);
+    for (int i = 0; i < GRID_CELLS; ++i) b.order[i] = i;
+    for (int i = GRID_CELLS - 1; i > 0; --i) {
+        int j = RngBelow(&b.rng, i + 1);
+        int t = b.order[i]; b.order[i] = b.order[j]; b.order[j] = t;
+    }
+    /* mid-game knowledge: the first 30 shots of the shuffled order */
+    for (int i = 0; i < 30; ++i) {
+        int cell = b.order[i];
+        RecordShot(&b.midGame, cell / GRID_SIZE, cell % GRID_SIZE,
+                   BitboardTest(b.board.ships, cell));
+    }
+    /* a game after 30 shots by each side, for packing */
+    for (int i = 0; i < 2; ++i) InitGame(&b.sides[i], &b.rng);
+    for (int i = 0; i < 30; ++i) {
+        for (int side = 0; side < 2; ++side) {
+            int cell = b.order[(i * 7 + side * 31) % GRID_CELLS];
+            int result = ApplyShotToGrid(&b.sides[1 - side].playerShips, cell / GRID_SIZE, cell % GRID_SIZE);
+            RecordShot(&b.sides[side].playerShots, cell / GRID_SIZE, cell % GRID_SIZE, result != 0);
+        }
+    }
+    /* and each side has sunk the other's last ship, so the round trip
+       below covers sunk ships too */
+    for (int side = 0; side < 2; ++side) {
+        Bitboard cells = b.sides[1 - side].playerShips.fleet[NUM_SHIPS - 1];
+        while (BitboardAny(cells)) {
+            int cell = BitboardPopLowest(&cells);
+            int result = ApplyShotToGrid(&b.sides[1 - side].playerShips, cell / GRID_SIZE, cell % GRID_SIZE);
+            RecordShot(&b.sides[side].playerShots, cell / GRID_SIZE, cell % GRID_SIZE, result != 0);
+        }
+    }
+    PackGame(b.sides, &b.packed);
+    int winner;
+    ReplayBegin(&b.replay, 1, REPLAY_SIM);
+    SimulateGame(&b.rng, &winner, &b.replay);
+    if (!PackedRoundTripOk(b.sides)) {
+        fprintf(stderr, "pack_game: the unpacked game differs from the packed one\n");
+        return 1;
+    }
+
+    BenchResult results[BENCH_MAX_RESULTS];
+    int n = 0;
+    printf("%-22s %12s %10s %10s %10s %10s\n", "benchmark", "ns/op", "p50", "p90", "p99", "allocs/op");
+    for (int i = 0; i < count; ++i) {
+        if (filter && !strstr(benches[i].name, filter)) continue;
+
+        int savedStdout = -1;
+        if (benches[i].printsToStdout) {
+            /* send the drawing to /dev/null while it is timed */
+            fflush(stdout);
+            savedStdout = dup(STDOUT_FILENO);
+            int devnull = open("/dev/null", O_WRONLY);
+            if (devnull >= 0) { dup2(devnull, STDOUT_FILENO); close(devnull); }
+        }
+        results[n] = RunBenchmark(benches[i].name, benches[i].fn, &b);
+        if (savedStdout >= 0) {
+            fflush(stdout);
+            dup2(savedStdout, STDOUT_FILENO);
+            close(savedStdout);
+        }
 
-    PlayTwoPlayer(localGame, sockfd, 0); /* client waits first, then shoots */
+        BenchResult *r = &results[n++];
+        printf("%-22s %12.1f %10.1f %10.1f %10.1f %10.3f\n",
+               r->name, r->mean, r->p50, r->p90, r->p99, r->allocsPerOp);
+        fflush(stdout);
+    }
+    if ((unsigned)b.sink == 0xFFFFFFFFu) printf("\n"); /* use the sink */
 
-    FreeGrid(localGame->playerShips);
-    FreeGrid(localGame->playerShots);
-    free(localGame);
+    if (jsonPath && WriteBenchJson(jsonPath, results, n) < 0) return 1;
     return 0;
 }
 
-/* Main: choose single-player, server, or client */
+/* Main: choose single-player, server, client, simulation, or benchmarks */
 int main(int argc, char *argv[]) {
-    srand((unsigned)time(NULL));
+    /* --ansi, --record FILE, --board RxC, --fleet LIST and --fleets N may
+       come anywhere: take them out before looking at the rest */
+    const char *boardArg = NULL, *fleetArg = NULL, *fleetsArg = NULL;
+    for (int i = 1; i < argc; ) {
+        int take = 0;
+        if (strcmp(argv[i], "--ansi") == 0) {
+            ansiMode = 1;
+            take = 1;
+        } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            replayPath = argv[i + 1];
+            take = 2;
+        } else if (strcmp(argv[i], "--board") == 0 && i + 1 < argc) {
+            boardArg = argv[i + 1];
+            take = 2;
+        } else if (strcmp(argv[i], "--fleet") == 0 && i + 1 < argc) {
+            fleetArg = argv[i + 1];
+            take = 2;
+        } else if (strcmp(argv[i], "--fleets") == 0 && i + 1 < argc) {
+            fleetsArg = argv[i + 1];
+            take = 2;
+        }
+        if (!take) { ++i; continue; }
+        memmove(&argv[i], &argv[i + take], (size_t)(argc - i - take + 1) * sizeof(argv[0]));
+        argc -= take;
+    }
+    if (ConfigureBoard(boardArg, fleetArg, fleetsArg) < 0) return 1;
+    /* Replays, the network protocol and the --ansi screen are 10x10 only */
+    if (boardConfig.custom && (ansiMode || replayPath ||
+                               (argc != 1 && strcmp(argv[1], "--simulate") != 0))) {
+        fprintf(stderr, "--board and --fleet work with single-player and --simulate only, without --ansi or --record\n");
+        return 1;
+    }
+    if (replayPath) {
+        replayOut = ReplayFileOpen(replayPath);
+        if (!replayOut || ReplayWriterInit(&replayWriter, replayOut) < 0) return 1;
+        atexit(ReplayFinish);
+    }
 
-    if (argc == 1) {
-        /* No arguments: single-player (you vs computer) */
-        GameState *game = malloc(sizeof(GameState));
-        if (!game) { perror("malloc"); return 1; }
-        CellStatus **computerShips = AllocateGrid();
+    if (argc >= 3 && strcmp(argv[1], "--replay") == 0) {
+        /* --replay FILE [--verify] [--dump]: read a replay file back */
+        int verify = 0, dump = 0;
+        for (int i = 3; i < argc; ++i) {
+            if (strcmp(argv[i], "--verify") == 0) {
+                verify = 1;
+            } else if (strcmp(argv[i], "--dump") == 0) {
+                dump = 1;
+            } else {
+                fprintf(stderr, "Unknown option: %s\n", argv[i]);
+                return 1;
+            }
+        }
+        return RunReplayScan(argv[2], verify, dump);
+    }
+
+    if (argc >= 3 && strcmp(argv[1], "--analyze") == 0) {
+        /* --analyze FILE [--threads T]: statistics over a replay file */
+        int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        if (argc == 5 && strcmp(argv[3], "--threads") == 0) {
+            threads = atoi(argv[4]);
+        } else if (argc != 3) {
+            fprintf(stderr, "Usage: %s --analyze <file> [--threads <n>]\n", argv[0]);
+            return 1;
+        }
+        return RunReplayAnalysis(argv[2], threads);
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "--bench") == 0) {
+        /* --bench [--filter NAME] [--json FILE]: time the core functions */
+        const char *filter = NULL;
+        const char *jsonPath = NULL;
+        for (int i = 2; i + 1 < argc; i += 2) {
+            if (strcmp(argv[i], "--filter") == 0) {
+                filter = argv[i + 1];
+            } else if (strcmp(argv[i], "--json") == 0) {
+                jsonPath = argv[i + 1];
+            } else {
+                fprintf(stderr, "Unknown option: %s\n", argv[i]);
+                return 1;
+            }
+        }
+        return RunBenchmarks(filter, jsonPath);
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "--solve") == 0) {
+        /* --solve [FILE] [--threads T]: exact ship chances for a position */
+        const char *path = NULL;
+        int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        for (int i = 2; i < argc; ++i) {
+            if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+                threads = atoi(argv[++i]);
+            } else if (!path && argv[i][0] != '-') {
+                path = argv[i];
+            } else {
+                fprintf(stderr, "Unknown option: %s\n", argv[i]);
+                return 1;
+            }
+        }
+        return RunSolver(path, threads);
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "--simulate") == 0) {
+        /* --simulate N [--seed S] [--threads T] [--ai density|random|exact]
+           [--placement fast|uniform] [--tt-mb MB]:
+           headless computer-vs-computer games */
+        long games = argc >= 3 ? atol(argv[2]) : 0;
+        uint64_t seed = (uint64_t)time(NULL);
+        int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        size_t ttMegabytes = 0;
+        if (games <= 0) {
+            fprintf(stderr, "Usage: %s --simulate <games> [--seed <seed>] [--threads <n>] [--ai density|random|exact] [--placement fast|uniform] [--tt-mb <MB>]\n", argv[0]);
+            return 1;
+        }
+        for (int i = 3; i + 1 < argc; i += 2) {
+            if (strcmp(argv[i], "--seed") == 0) {
+                seed = strtoull(argv[i + 1], NULL, 10);
+            } else if (strcmp(argv[i], "--threads") == 0) {
+                threads = atoi(argv[i + 1]);
+            } else if (strcmp(argv[i], "--placement") == 0) {
+                placementMode = strcmp(argv[i + 1], "uniform") == 0 ? PLACE_UNIFORM : PLACE_FAST;
+            } else if (strcmp(argv[i], "--ai") == 0) {
+                computerStrategy = ParseStrategy(argv[i + 1]);
+            } else if (strcmp(argv[i], "--tt-mb") == 0) {
+                ttMegabytes = (size_t)atol(argv[i + 1]);
+            } else {
+                fprintf(stderr, "Unknown option: %s\n", argv[i]);
+                return 1;
+            }
+        }
+        if (ttMegabytes && TTInit(ttMegabytes) < 0) return 1;
+        return RunSimulation(games, seed, threads);
+    }
+
+    uint64_t seed = (uint64_t)time(NULL);
+    RngSeed(&gameRng, seed);
+
+    if (argc >= 3 && strcmp(argv[1], "--serve") == 0) {
+        /* --serve <port> [--shards N] [--io epoll|uring] [--text] [--match-log]
+           [--metrics-port P] [--metrics-file F]: many clients at once, each against the computer */
+        int port = atoi(argv[2]);
+        int shards = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        if (port <= 0) {
+            fprintf(stderr, "Invalid port: %s\n", argv[2]);
+            return 1;
+        }
+        for (int i = 3; i < argc; ++i) {
+            if (strcmp(argv[i], "--text") == 0) {
+                protocolOfferBinary = 0;
+            } else if (strcmp(argv[i], "--match-log") == 0) {
+                serverMatchLog = 1;
+            } else if (strcmp(argv[i], "--shards") == 0 && i + 1 < argc) {
+                shards = atoi(argv[++i]);
+            } else if (strcmp(argv[i], "--io") == 0 && i + 1 < argc) {
+                serverIo = strcmp(argv[++i], "uring") == 0 ? IO_URING : IO_EPOLL;
+            } else if (strcmp(argv[i], "--metrics-port") == 0 && i + 1 < argc) {
+                metricsServer.port = atoi(argv[++i]);
+                if (metricsServer.port <= 0) {
+                    fprintf(stderr, "Invalid port: %s\n", argv[i]);
+                    return 1;
+                }
+            } else if (strcmp(argv[i], "--metrics-file") == 0 && i + 1 < argc) {
+                metricsServer.path = argv[++i];
+            } else {
+                fprintf(stderr, "Unknown option: %s\n", argv[i]);
+                return 1;
+            }
+        }
+        return RunMatchServer(port, shards) < 0 ? 1 : 0;
+    }
+
+    if (argc >= 4 && strcmp(argv[1], "--load") == 0) {
+        /* --load <ip> <port> [--clients N] [--games G] [--seconds S] [--text] [--ai density|random|exact]:
+           many computer players against a server */
+        int port = atoi(argv[3]);
+        int clients = 100;
+        long games = 0;
+        double seconds = 10;
+        if (port <= 0) {
+            fprintf(stderr, "Invalid port: %s\n", argv[3]);
+            return 1;
+        }
+        for (int i = 4; i < argc; ++i) {
+            if (strcmp(argv[i], "--text") == 0) {
+                protocolOfferBinary = 0;
+            } else if (i + 1 < argc && strcmp(argv[i], "--clients") == 0) {
+                clients = atoi(argv[++i]);
+            } else if (i + 1 < argc && strcmp(argv[i], "--games") == 0) {
+                games = atol(argv[++i]);
+            } else if (i + 1 < argc && strcmp(argv[i], "--seconds") == 0) {
+                seconds = atof(argv[++i]);
+            } else if (i + 1 < argc && strcmp(argv[i], "--ai") == 0) {
+                computerStrategy = ParseStrategy(argv[++i]);
+            } else {
+                fprintf(stderr, "Unknown option: %s\n", argv[i]);
+                return 1;
+            }
+        }
+        if (clients <= 0) {
+            fprintf(stderr, "Invalid client count\n");
+            return 1;
+        }
+        return RunLoadGenerator(argv[2], port, clients, games, seconds, NULL);
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "--stress-io") == 0) {
+        /* --stress-io [--port P] [--shards N] [--clients N] [--seconds S]:
+           the server's epoll and io_uring backends over loopback */
+        int port = 5599, shards = 1, clients = 200;
+        double seconds = 5;
+        for (int i = 2; i < argc; ++i) {
+            if (i + 1 < argc && strcmp(argv[i], "--port") == 0) {
+                port = atoi(argv[++i]);
+            } else if (i + 1 < argc && strcmp(argv[i], "--shards") == 0) {
+                shards = atoi(argv[++i]);
+            } else if (i + 1 < argc && strcmp(argv[i], "--clients") == 0) {
+                clients = atoi(argv[++i]);
+            } else if (i + 1 < argc && strcmp(argv[i], "--seconds") == 0) {
+                seconds = atof(argv[++i]);
+            } else {
+                fprintf(stderr, "Unknown option: %s\n", argv[i]);
+                return 1;
+            }
+        }
+        if (port <= 0 || clients <= 0 || seconds <= 0) {
+            fprintf(stderr, "Usage: %s --stress-io [--port <p>] [--shards <n>] [--clients <n>] [--seconds <s>]\n", argv[0]);
+            return 1;
+        }
+        return RunIoStress(port, shards, clients, seconds);
+    }
 
-        game->playerShips = AllocateGrid();
-        game->playerShots = AllocateGrid();
+    if (argc == 1 && boardConfig.sparse) return RunSparseSinglePlayer(&gameRng);
+    if (argc == 1 && boardConfig.custom) return RunWideSinglePlayer(&gameRng);
 
+    if (argc == 1) {
+        /* No arguments: single-player (you vs computer) */
         /* Place ships for you and for computer */
-        RandomlyPlaceShips(game->playerShips);
-        RandomlyPlaceShips(computerShips);
+        GameState *game = SetupSinglePlayer(&gameRng);
+        Board *computerShips = AllocateGrid();
+        RandomlyPlaceShips(computerShips, &gameRng);
+        ReplayRecord replay; /* you are side 0, the computer side 1 */
+        ReplayBegin(&replay, seed, REPLAY_SINGLE);
+        ReplaySetFleet(&replay, 0, &game->playerShips);
+        ReplaySetFleet(&replay, 1, computerShips);
 
         printf("Welcome to Battleship (single-player).\nType 'quit' at any prompt to exit.\n");
 
@@ -536,53 +6703,54 @@ int main(int argc, char *argv[]) {
                 printf("Quitting.\n");
                 break;
             }
-            if (strlen(input) < 2) {
+            int row, col;
+            int parsed = ParseCell(input, GRID_SIZE, GRID_SIZE, &row, &col);
+            if (parsed == -1) {
                 printf("Invalid input.\n");
                 continue;
             }
-            int row = toupper((unsigned char)input[0]) - 'A';
-            int col = input[1] - '0';
-            if (row < 0 || row >= GRID_SIZE || col < 0 || col >= GRID_SIZE) {
+            if (parsed == -2) {
                 printf("Coordinates out of range.\n");
                 continue;
             }
-            if (game->playerShots[row][col] != EMPTY) {
+            if (GridAlreadyShot(&game->playerShots, row, col)) {
                 printf("You already shot there.\n");
                 continue;
             }
 
-            int hit = ApplyShotToGrid(computerShips, row, col);
-            game->playerShots[row][col] = hit ? HIT : MISS;
-            if (hit) printf("You hit a ship at %c%d!\n", 'A'+row, col);
-            else     printf("You missed at %c%d.\n", 'A'+row, col);
+            int result = ApplyShotToGrid(computerShips, row, col);
+            RecordShot(&game->playerShots, row, col, result != 0);
+            ReplayAddShot(&replay, row, col);
+            if (result & RESULT_SUNK) printf("You sank the %s at %c%d!\n", ships[ResultShip(result)].name, 'A'+row, col);
+            else if (result)          printf("You hit a ship at %c%d!\n", 'A'+row, col);
+            else                      printf("You missed at %c%d.\n", 'A'+row, col);
 
-            if (GridAllShipsDestroyed(computerShips)) {
+            if (result & RESULT_WIN) {
                 printf("You won! All opponent ships destroyed.\n");
+                ReplaySetWinner(&replay, 0);
                 break;
             }
 
-            /* Computer picks a random new spot to shoot */
+            /* Computer picks the most likely spot it has not shot yet */
             int crow, ccol;
-            do {
-                crow = rand() % GRID_SIZE;
-                ccol = rand() % GRID_SIZE;
-            } while (game->playerShips[crow][ccol] == HIT ||
-                     game->playerShips[crow][ccol] == MISS);
+            ComputerPickShot(&game->playerShips, &gameRng, &crow, &ccol);
 
-            int chit = ApplyShotToGrid(game->playerShips, crow, ccol);
-            if (chit) printf("Computer hit you at %c%d!\n", 'A'+crow, ccol);
-            else      printf("Computer missed at %c%d.\n", 'A'+crow, ccol);
+            int cresult = ApplyShotToGrid(&game->playerShips, crow, ccol);
+            ReplayAddShot(&replay, crow, ccol);
+            if (cresult & RESULT_SUNK) printf("Computer sank your %s at %c%d!\n", ships[ResultShip(cresult)].name, 'A'+crow, ccol);
+            else if (cresult)          printf("Computer hit you at %c%d!\n", 'A'+crow, ccol);
+            else                       printf("Computer missed at %c%d.\n", 'A'+crow, ccol);
 
-            if (GridAllShipsDestroyed(game->playerShips)) {
+            if (cresult & RESULT_WIN) {
                 printf("Computer won! Your ships are destroyed.\n");
+                ReplaySetWinner(&replay, 1);
                 break;
             }
         }
 
-        FreeGrid(game->playerShips);
-        FreeGrid(game->playerShots);
+        ReplayAppend(&replayWriter, &replay);
         FreeGrid(computerShips);
-        free(game);
+        TeardownSinglePlayer(game);
         return 0;
     } else if (argc == 2) {
         /* One argument: server mode, argument is port */
@@ -591,7 +6759,7 @@ int main(int argc, char *argv[]) {
             fprintf(stderr, "Invalid port: %s\n", argv[1]);
             return 1;
         }
-        return RunServerMode(port);
+        return RunServerMode(port, seed);
     } else if (argc == 3) {
         /* Two arguments: client mode, ip and port */
         const char *ip = argv[1];
@@ -600,12 +6768,21 @@ int main(int argc, char *argv[]) {
             fprintf(stderr, "Invalid port: %s\n", argv[2]);
             return 1;
         }
-        return RunClientMode(ip, port);
+        return RunClientMode(ip, port, seed);
     } else {
-        fprintf(stderr, "Usage:\n");
+        fprintf(stderr, "Usage (add --ansi to redraw boards in place, --record <file> to save replays,\n"
+                        "       --board <rows>x<cols>, --fleet <sizes> and --fleets <n> to single-player or --simulate for another board):\n");
         fprintf(stderr, "  %s              (single-player)\n", argv[0]);
         fprintf(stderr, "  %s <port>       (server)\n", argv[0]);
+        fprintf(stderr, "  %s --serve <port> [--shards <n>] [--io epoll|uring] [--text] [--match-log] [--metrics-port <p>] [--metrics-file <file>]  (many clients, each against the computer)\n", argv[0]);
         fprintf(stderr, "  %s <ip> <port>  (client)\n", argv[0]);
+        fprintf(stderr, "  %s --load <ip> <port> [--clients <n>] [--games <n>] [--seconds <s>] [--text] [--ai density|random|exact]  (load generator)\n", argv[0]);
+        fprintf(stderr, "  %s --stress-io [--port <p>] [--shards <n>] [--clients <n>] [--seconds <s>]  (epoll vs io_uring over loopback)\n", argv[0]);
+        fprintf(stderr, "  %s --simulate <games> [--seed <seed>] [--threads <n>] [--ai density|random|exact] [--placement fast|uniform] [--tt-mb <MB>]  (headless benchmark)\n", argv[0]);
+        fprintf(stderr, "  %s --solve [<file>] [--threads <n>]  (exact ship chances for a position)\n", argv[0]);
+        fprintf(stderr, "  %s --bench [--filter <name>] [--json <file>]  (function benchmarks)\n", argv[0]);
+        fprintf(stderr, "  %s --replay <file> [--verify] [--dump]  (read a replay file)\n", argv[0]);
+        fprintf(stderr, "  %s --analyze <file> [--threads <n>]  (statistics over a replay file)\n", argv[0]);
         return 1;
     }
 }
\ No newline at end of file